@@ -12,10 +12,21 @@
  * - Providing validated and organized data to the TaskHandler for further processing
  */
 #include <string>
+#include <map>
+#include <unordered_map>
 #include "../include/CalibrationDataProvider.h"
+#include "../include/FileManager.h"
 
 class ArgumentsManager
 {
+public:
+    // One run of a batch (-runs / -jobs), an empty savePath keeps the usual layout
+    struct RunJob
+    {
+        std::string histogramFilePath;
+        std::string savePath;
+    };
+
 private:
     // File data structures
     struct fitLimits
@@ -51,6 +62,8 @@ private:
     int xMinDomain = -1;
     int xMaxDomain = -1;
     std::vector<int> domain;
+    std::unordered_map<int, int> domainIndex; // domain -> position in the LUT vectors
+    int gammaGammaReferenceDomain = -1;
 
     // Detector configuration
     int detTypeStandard = 2;
@@ -67,6 +80,22 @@ private:
 
     // State
     bool userInterfaceStatus = true;
+    int numberOfWorkers = 1;
+    int numberOfShards = 1;
+    std::vector<RunJob> batchJobs;
+    std::string watchDirectory;
+    bool watchMode = false;
+    bool incrementalRun = false;
+    bool resumeRun = false;
+    std::string cacheDirectory;
+    int cacheSizeMB = 512;
+    bool shardMergeOnly = false;
+    int outputSinks; // bit mask of FileManager::OutputFile
+    std::map<FileManager::OutputFile, FileManager::CompressionProfile> compressionProfiles;
+    bool compressionBenchmark = false;
+    std::string rawConversionPath;
+    std::string listModeTree;
+    int listModeChannels = ListModeSpectra::DEFAULT_CHANNELS;
 
     // Private helper methods
     bool validateInputParameters() const;
@@ -74,6 +103,11 @@ private:
     std::string getHistogramFilename(int runNumber) const;
     bool isNumber(const std::string &s) const;
     bool fileExists(const std::string &path) const;
+    bool parseOutputSinks(const std::string &list);
+    bool parseCompressionProfiles(const std::string &list);
+    std::string resolveHistogramFile(const std::string &input) const;
+    bool parseRunList(const std::string &list);
+    bool parseJobFile(const std::string &path);
 
 public:
     // Constructor and main interface
@@ -88,6 +122,22 @@ public:
     bool isDomainLimitsSet() const;
     bool checkIfRunIsValid() const;
     bool isUserInterfaceEnabled() const { return userInterfaceStatus; }
+    int getOutputSinks() const { return outputSinks; }
+    const std::map<FileManager::OutputFile, FileManager::CompressionProfile> &getCompressionProfiles() const { return compressionProfiles; }
+    bool isCompressionBenchmark() const { return compressionBenchmark; }
+    const std::string &getRawConversionPath() const { return rawConversionPath; }
+    const std::string &getListModeTree() const { return listModeTree; }
+    int getListModeChannels() const { return listModeChannels; }
+    int getNumberOfWorkers() const { return numberOfWorkers; }
+    int getNumberOfShards() const { return numberOfShards; }
+    bool isShardMergeOnly() const { return shardMergeOnly; }
+    const std::vector<RunJob> &getBatchJobs() const { return batchJobs; }
+    bool isWatchMode() const { return watchMode; }
+    bool isIncrementalRun() const { return incrementalRun; }
+    bool isResumeRun() const { return resumeRun; }
+    const std::string &getCacheDirectory() const { return cacheDirectory; }
+    int getCacheSizeMB() const { return cacheSizeMB; }
+    const std::string &getWatchDirectory() const { return watchDirectory; }
 
     // Print functions
     void printUsage() const;
@@ -117,6 +167,7 @@ public:
     // Domain and file getters
     int getXmaxDomain() const { return xMaxDomain; }
     int getXminDomain() const { return xMinDomain; }
+    int getGammaGammaReferenceDomain() const { return gammaGammaReferenceDomain; }
     int getXminFile(int position) const { return limits[position].Xmin; }
     int getXmaxFile(int position) const { return limits[position].Xmax; }
     int getFWHMmaxFile(int position) const { return fwhm[position]; }
@@ -127,6 +178,7 @@ public:
 
     // Declare non-inlined functions
     int getNumberColumnSpecified(int histogramNumber) const;
+    std::vector<int> getConfiguredDomains() const; // LUT domains in ascending order
 
     // Other functions
     void setNumberOfPeaks(int peaks);
@@ -0,0 +1,82 @@
+/**
+ * @class BoundedQueue
+ * @brief Blocking FIFO with a fixed capacity, used to connect the stages of the column pipeline.
+ *
+ * push() blocks while the queue is full, so a fast producer cannot run ahead of a slow consumer
+ * and the memory held between two stages is bounded by the capacity. pop() blocks while the queue
+ * is empty and returns false once the producer has called close() and everything was consumed.
+ *
+ * Example usage:
+ *     BoundedQueue<int> queue(4);
+ *     std::thread producer([&] { for (int i = 0; i < 100; ++i) queue.push(i); queue.close(); });
+ *     int value;
+ *     while (queue.pop(value)) { ... }
+ *     producer.join();
+ */
+
+#ifndef BOUNDEDQUEUE_H
+#define BOUNDEDQUEUE_H
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+
+template <typename T>
+class BoundedQueue
+{
+private:
+    std::deque<T> items;
+    size_t capacity;
+    bool closed;
+    std::mutex mutex;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(std::max<size_t>(capacity, 1)), closed(false) {}
+    BoundedQueue(const BoundedQueue &) = delete;
+    BoundedQueue &operator=(const BoundedQueue &) = delete;
+
+    // Returns false (and drops the item) when the queue was closed
+    bool push(T item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [this]
+                     { return closed || items.size() < capacity; });
+        if (closed)
+            return false;
+        items.push_back(std::move(item));
+        lock.unlock();
+        notEmpty.notify_one();
+        return true;
+    }
+
+    // Returns false when the queue is closed and empty
+    bool pop(T &item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [this]
+                      { return closed || !items.empty(); });
+        if (items.empty())
+            return false;
+        item = std::move(items.front());
+        items.pop_front();
+        lock.unlock();
+        notFull.notify_one();
+        return true;
+    }
+
+    // No more items will be pushed, consumers drain what is left
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+        }
+        notFull.notify_all();
+        notEmpty.notify_all();
+    }
+};
+
+#endif // BOUNDEDQUEUE_H
@@ -0,0 +1,96 @@
+/**
+ * @class CalibrationCache
+ * @brief On-disk cache of peak tables and calibration polynomials, addressed by the content of their inputs.
+ *
+ * Reprocessing the same spectra with the same settings gives the same peaks, so the result of every
+ * detector is stored under a 64-bit key made of:
+ * - the raw counts of its TH2 column and its LUT entry (see RunManifest)
+ * - the fit settings: energy array of the selected sources, number of peaks, amplitude and threshold options
+ * - ALGORITHM_VERSION, bumped whenever the peak search or the calibration gives different results
+ * A hit replaces Histogram::findPeaks() and calibratePeaks() by one small file read.
+ *
+ * Every entry is one file `<key>.cal` in the cache directory, written to a temporary name and renamed,
+ * so several processes (shards, batches) can share a directory. The modification time of a file is its
+ * last use; when the directory grows over its size limit the least recently used entries are removed.
+ *
+ * lookup() and store() can be called from the fit workers concurrently.
+ *
+ * Example usage:
+ *     CalibrationCache cache("calibration_cache/", 256 << 20);
+ *     cache.open();
+ *     CalibrationCache::Result result;
+ *     if (!cache.lookup(key, result)) { ...fit...; cache.store(key, result); }
+ */
+
+#ifndef CALIBRATIONCACHE_H
+#define CALIBRATIONCACHE_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class CalibrationCache
+{
+public:
+    static const uint32_t ALGORITHM_VERSION = 1;
+    static const int FIT_PARAMETERS = 6; // gaussian + quadratic background, see Histogram::createGaussianFit
+
+    // Fitted function of one peak and the values derived from the spectrum
+    struct PeakRecord
+    {
+        double parameters[FIT_PARAMETERS];
+        double errors[FIT_PARAMETERS];
+        double rangeMin;
+        double rangeMax;
+        double associatedPosition;
+        double area;
+        double areaError;
+    };
+
+    struct Result
+    {
+        std::vector<PeakRecord> peaks;
+        std::vector<double> coefficients;
+        uint32_t peakMatchCount = 0;
+    };
+
+private:
+    struct IndexEntry
+    {
+        uint64_t size;
+        int64_t lastUse; // nanoseconds, the modification time of the file
+    };
+
+    std::string directory;
+    uint64_t maxBytes;
+    uint64_t totalBytes;
+    std::unordered_map<uint64_t, IndexEntry> index;
+    mutable std::mutex indexMutex; // guards index and totalBytes
+    std::atomic<int> hits;
+    std::atomic<int> misses;
+    std::atomic<int> temporaryCounter;
+
+    std::string getEntryPath(uint64_t key) const;
+    void evictLocked();
+
+public:
+    CalibrationCache(const std::string &directory, uint64_t maxBytes);
+
+    // Binary form of a Result, also used by the CheckpointJournal
+    static std::string serialize(const Result &result);
+    static bool deserialize(const std::string &data, Result &result);
+
+    bool open();
+    bool lookup(uint64_t key, Result &result);
+    void store(uint64_t key, const Result &result);
+
+    int getHits() const { return hits; }
+    int getMisses() const { return misses; }
+    uint64_t getTotalBytes() const;
+    const std::string &getDirectory() const { return directory; }
+};
+
+#endif // CALIBRATIONCACHE_H
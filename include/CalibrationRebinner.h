@@ -0,0 +1,86 @@
+/**
+ * @class CalibrationRebinner
+ * @brief Maps a channel spectrum onto a calibrated (energy) axis while conserving counts.
+ *
+ * The calibration polynomial is evaluated once per source bin edge and stored in a table.
+ * Every source bin is then treated as the interval between two calibrated edges and its
+ * counts are split across the destination bins it overlaps, proportionally to the overlap.
+ *
+ * Key features:
+ * - One polynomial evaluation per bin edge (n + 1 evaluations for n bins)
+ * - Single linear sweep over contiguous arrays, no FindBin / GetBinCenter calls
+ * - Counts are conserved: whatever falls outside the destination axis goes to the
+ *   underflow / overflow bins instead of being dropped
+ *
+ * A polynomial that gives a non-finite edge (NaN or inf from a failed fit) makes the rebinner
+ * invalid: isValid() is false and rebin() / rebin2D() leave the destination untouched, the caller
+ * skips the spectrum and logs it.
+ *
+ * Arrays follow the ROOT TH1 layout: index 0 is the underflow bin, 1..n are the
+ * regular bins and n + 1 is the overflow bin. The destination can be a TH1D array
+ * or a float column of a larger buffer (e.g. one column of the combined TH2).
+ *
+ * Example usage:
+ *     CalibrationRebinner rebinner(coefficients, nBins, 0, nBins, nBins, 0, nBins);
+ *     rebinner.rebin(mainHist->GetArray(), calibratedHist->GetArray());
+ */
+
+#ifndef CALIBRATIONREBINNER_H
+#define CALIBRATIONREBINNER_H
+
+#include <vector>
+
+class CalibrationRebinner
+{
+private:
+    std::vector<double> calibratedEdges; // sourceBins + 1 calibrated edges
+    int sourceBins;
+    int destinationBins;
+    double destinationMin;
+    double destinationMax;
+    double destinationWidth;
+    bool finiteEdges; // every calibrated edge is finite
+
+    void buildEdgeTable(const std::vector<double> &coefficients, double sourceMin, double sourceMax);
+    int findDestinationBin(double value) const;
+    double getDestinationLowEdge(int bin) const;
+    template <typename AddFunction>
+    void distributeBin(int bin, double counts, AddFunction add) const;
+
+public:
+    CalibrationRebinner(const std::vector<double> &coefficients,
+                        int sourceBins, double sourceMin, double sourceMax,
+                        int destinationBins, double destinationMin, double destinationMax);
+
+    /**
+     * @brief Redistributes the source counts over the destination axis.
+     *
+     * @param source Source bin contents (sourceBins + 2 values, ROOT layout).
+     * @param destination Destination bin contents (destinationBins + 2 values, ROOT layout),
+     *                    counts are added to the existing content.
+     * @param firstBin, lastBin Regular source bins to read (default all), for spectra whose active
+     *                          range is known; underflow and overflow are always read.
+     *
+     * Instantiated for double -> double (TH1D), double -> float (TH2F column buffer)
+     * and float -> double (TH2F rows).
+     */
+    template <typename SourceT, typename DestinationT>
+    void rebin(const SourceT *source, DestinationT *destination, int firstBin = 1, int lastBin = -1) const;
+
+    /**
+     * @brief Calibrates both axes of a matrix stored x-fastest (TH2F layout, under/overflow included).
+     *
+     * This rebinner maps the y axis, xRebinner maps the x axis. Counts are conserved.
+     */
+    template <typename SourceT, typename DestinationT>
+    void rebin2D(const CalibrationRebinner &xRebinner, const SourceT *source, DestinationT *destination) const;
+
+    bool isValid() const { return finiteEdges; }
+    const std::vector<double> &getCalibratedEdges() const { return calibratedEdges; }
+    int getSourceBins() const { return sourceBins; }
+    int getDestinationBins() const { return destinationBins; }
+
+    static double evaluatePolynomial(const std::vector<double> &coefficients, double x);
+};
+
+#endif // CALIBRATIONREBINNER_H
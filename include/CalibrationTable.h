@@ -0,0 +1,86 @@
+/**
+ * @class CalibrationTable
+ * @brief Dense per-detector lookup tables for event-by-event energy conversion.
+ *
+ * The calibration polynomials found by Histogram::calibratePeaksByDegree() are only applied
+ * to whole spectra inside this tool. List-mode processing needs the same conversion for every
+ * single event, so this class precomputes for every detector:
+ * - a dense channel -> energy table (one polynomial evaluation per channel, done once)
+ * - a monotonic inverse energy -> channel table on an energy grid spanning the detector's own monotonic
+ *   range, read with linear interpolation
+ *
+ * The batch API converts arrays of (domain, channel) pairs. When compiled with AVX2
+ * (-mavx2) the lookups use hardware gathers, 8 events per iteration, with a scalar tail.
+ * Unknown domains or channels outside the table give NaN.
+ *
+ * The class has no ROOT dependency, so list-mode code can include it directly and load
+ * the `_calibration_table.bin` file written by this tool with readFromFile().
+ *
+ * File layout (little endian, written by writeToFile()):
+ *     char[8]  magic "ELICALT1"
+ *     int32    numberOfChannels, firstChannel, numberOfDetectors
+ *     per detector: int32 domain, int32 numberOfCoefficients, double coefficients[numberOfCoefficients]
+ * The tables themselves are rebuilt from the coefficients when the file is read.
+ *
+ * Example usage:
+ *     CalibrationTable table;
+ *     table.readFromFile("output/152_calibration_table.bin"); // calls build()
+ *     table.convertToEnergy(domains, channels, energies, numberOfEvents);
+ */
+
+#ifndef CALIBRATIONTABLE_H
+#define CALIBRATIONTABLE_H
+
+#include <vector>
+#include <string>
+#include <cstddef>
+
+class CalibrationTable
+{
+private:
+    struct Detector
+    {
+        int domain;
+        std::vector<double> coefficients;
+        int inverseFirst;  // first energy grid point covered by the monotonic part
+        int inverseLast;   // last energy grid point covered by the monotonic part
+        double energyMin;  // energy of grid point 0
+        double energyStep; // energy between grid points, 0 when nothing can be inverted
+    };
+
+    int numberOfChannels;
+    int firstChannel;
+    std::vector<Detector> detectors;
+
+    // Dense tables, detector slot s starts at s * numberOfChannels (s * numberOfEnergyBins for the inverse)
+    std::vector<int> domainOffsets; // domain -> offset in energyTable, -1 when not calibrated
+    std::vector<double> energyTable;
+    std::vector<double> channelTable;
+    int numberOfEnergyBins;
+
+    void buildInverseTable(int slot);
+
+public:
+    CalibrationTable();
+    CalibrationTable(int numberOfChannels, int firstChannel);
+
+    // Detectors are collected first, build() then fills all tables in one go
+    void addDetector(int domain, const std::vector<double> &coefficients);
+    void build();
+    bool writeToFile(const std::string &path) const;
+    bool readFromFile(const std::string &path, bool append = false); // append joins tables of other domains
+
+    // Single lookups
+    double channelToEnergy(int domain, int channel) const;
+    double energyToChannel(int domain, double energy) const;
+
+    // Batch conversions over arrays of (domain, channel) / (domain, energy) pairs
+    void convertToEnergy(const int *domains, const int *channels, double *energies, size_t count) const;
+    void convertToChannel(const int *domains, const double *energies, double *channels, size_t count) const;
+
+    int getNumberOfDetectors() const { return detectors.size(); }
+    int getNumberOfChannels() const { return numberOfChannels; }
+    bool hasDomain(int domain) const;
+};
+
+#endif // CALIBRATIONTABLE_H
@@ -0,0 +1,57 @@
+/**
+ * @class CheckpointJournal
+ * @brief Append-only record of the detectors a run has finished, used by -resume.
+ *
+ * The JSON and ROOT outputs of a run are only complete after FileManager::closeFiles(), so a crash
+ * late in a run used to lose every detector. The result of each detector (peaks and polynomial, see
+ * CalibrationCache::Result) is therefore appended to `<run>_journal.bin` as soon as it is written,
+ * and flushed. A run started with -resume reads the journal first: detectors found there with the
+ * same input hash are not fitted again, their results are imported and all outputs are rebuilt.
+ *
+ * The journal is removed when the run finishes normally.
+ *
+ * File layout:
+ *     char[8]  magic "ELIJRNL1"
+ *     uint64   settings hash of the run (a journal of other settings is not used)
+ *     records: int32 domain, uint64 input hash, uint32 size, char data[size], uint64 FNV-1a of data
+ * A record cut by a crash fails its checksum; reading stops there.
+ *
+ * Example usage:
+ *     CheckpointJournal journal;
+ *     journal.open(path, settingsHash, resume);
+ *     if (const CalibrationCache::Result *result = journal.find(domain, hash)) ...
+ *     journal.append(domain, hash, hist.exportResults());
+ */
+
+#ifndef CHECKPOINTJOURNAL_H
+#define CHECKPOINTJOURNAL_H
+
+#include "CalibrationCache.h"
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+
+class CheckpointJournal
+{
+private:
+    std::string path;
+    std::ofstream file;
+    std::mutex fileMutex;
+    std::map<int, std::pair<uint64_t, CalibrationCache::Result>> finished; // domain -> input hash, result
+
+    bool readExisting(uint64_t settingsHash);
+
+public:
+    bool open(const std::string &path, uint64_t settingsHash, bool resume);
+    void append(int domain, uint64_t inputHash, const CalibrationCache::Result &result);
+    const CalibrationCache::Result *find(int domain, uint64_t inputHash) const;
+    void remove();
+
+    bool isOpen() const { return file.is_open(); }
+    int getNumberOfFinished() const { return finished.size(); }
+};
+
+#endif // CHECKPOINTJOURNAL_H
@@ -0,0 +1,77 @@
+/**
+ * @class ColumnMatrix
+ * @brief Column-major copy of the selected columns of a TH2F, read with one cache-blocked transpose.
+ *
+ * TH2F stores its cells x-fastest, so ProjectionY() walks one column with a stride of (nx + 2)
+ * cells through the whole matrix and allocates a named TH1D in the current directory for it.
+ * ColumnMatrix copies only the requested columns, block of rows by block of rows, into one
+ * contiguous buffer. Every column is then a contiguous span in the TH1 layout
+ * (underflow, nBinsY channels, overflow).
+ *
+ * The peak fits still need a TH1D; createHistogram() builds it from the span with one contiguous
+ * copy, detached from any directory.
+ *
+ * A RawSpectraFile is already column-major: with float32 counts load() only records the columns and
+ * the spans point into the mapping of the file, nothing is copied. The same holds for the spectra
+ * filled from a list-mode tree (ListModeSpectra).
+ *
+ * Example usage:
+ *     ColumnMatrix matrix;
+ *     matrix.load(*inputTH2, columnsToProcess);
+ *     ColumnMatrix::Span counts = matrix.getColumn(12);           // counts[0] is the underflow
+ *     std::unique_ptr<TH1D> hist1D = matrix.createHistogram(12, "hist1D_col12");
+ */
+
+#ifndef COLUMNMATRIX_H
+#define COLUMNMATRIX_H
+
+#include <TH1D.h>
+#include <TH2.h>
+#include <vector>
+#include <string>
+#include <memory>
+
+class RawSpectraFile;
+class ListModeSpectra;
+
+class ColumnMatrix
+{
+public:
+    // Read-only view of one column, size = nBinsY + 2
+    struct Span
+    {
+        const float *data = nullptr;
+        int size = 0;
+
+        float operator[](int bin) const { return data[bin]; }
+        bool empty() const { return data == nullptr; }
+    };
+
+private:
+    std::vector<float> values;   // column-major, columnSize values per stored column
+    std::vector<int> slots;      // column -> position in values, -1 when the column was not loaded
+    const float *mappedValues;   // counts of a RawSpectraFile or ListModeSpectra, used instead of values
+    int columnSize;
+
+    // Channel axis of the source, reused for the TH1D of every column
+    std::string title;
+    int numberOfChannels;
+    double channelMin;
+    double channelMax;
+    std::vector<double> channelEdges; // only for variable bin sizes
+
+public:
+    ColumnMatrix();
+
+    void load(const TH2F &histogram, const std::vector<int> &columns);
+    void load(const RawSpectraFile &spectra, const std::vector<int> &columns);
+    void load(const ListModeSpectra &spectra, const std::vector<int> &columns);
+    void release();
+
+    bool hasColumn(int column) const;
+    Span getColumn(int column) const;
+    std::unique_ptr<TH1D> createHistogram(int column, const std::string &name) const;
+    int getColumnSize() const { return columnSize; }
+};
+
+#endif // COLUMNMATRIX_H
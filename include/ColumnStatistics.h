@@ -0,0 +1,51 @@
+/**
+ * @struct ColumnStatistics
+ * @brief Per-column summary of a TH2F, collected in one pass over its storage.
+ *
+ * ProjectionY() allocates a full TH1D for every column before anything can be decided about it.
+ * collect() walks the TH2F array row by row instead (the storage is x-fastest, so every row is
+ * contiguous) and records for every column:
+ * - integral, mean (in y axis units, like TH1::GetMean of the projection) and maximum of the regular bins
+ * - the first and last non-empty channel bin, the active range later loops are cropped to
+ * - a hash of its non-empty cells (channel and content, under/overflow included), see RunManifest
+ *
+ * Columns without counts have firstBin = lastBin = 0 and a mean of 0.
+ * The RawSpectraFile and ListModeSpectra overloads read every column as one contiguous span and give
+ * the same values.
+ *
+ * Example usage:
+ *     std::vector<ColumnStatistics> statistics = ColumnStatistics::collect(*inputTH2, configuredColumns);
+ *     if (statistics[column].mean < 5) { ... skip without projecting ... }
+ */
+
+#ifndef COLUMNSTATISTICS_H
+#define COLUMNSTATISTICS_H
+
+#include <TH2.h>
+#include <cstdint>
+#include <vector>
+
+class RawSpectraFile;
+class ListModeSpectra;
+
+struct ColumnStatistics
+{
+    double integral = 0;
+    double mean = 0;
+    float max = 0;
+    int firstBin = 0; // first non-empty channel bin, 0 when the column is empty
+    int lastBin = 0;  // last non-empty channel bin
+    uint64_t contentHash = 0;
+
+    bool isEmpty() const { return lastBin == 0; }
+
+    // Indexed by column (GetNbinsX() + 2 entries), only the given columns are read, the others stay empty
+    static std::vector<ColumnStatistics> collect(const TH2F &histogram, const std::vector<int> &columns);
+    static std::vector<ColumnStatistics> collect(const RawSpectraFile &spectra, const std::vector<int> &columns);
+    static std::vector<ColumnStatistics> collect(const ListModeSpectra &spectra, const std::vector<int> &columns);
+
+    // Adds one non-empty cell, the cells of a column must come in channel order
+    void addCell(int channel, float content, double center, bool regularBin, double &weightedSum);
+};
+
+#endif // COLUMNSTATISTICS_H
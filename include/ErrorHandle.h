@@ -3,6 +3,7 @@
 
 #include <string>
 #include <vector>
+#include <mutex>
 
 // Structure to represent an error entry
 struct ErrorEntry
@@ -50,6 +51,8 @@ public:
     void logLutFileInput(const std::string &lutFileName, int rowsRead);
     void logArrayWithCalibratedValues(const double *array, int size);
     void startProgram();
+    void clearLog(); // starts an empty log, used between the runs of a batch
+    int getNumberOfErrors();
 
     // Setter methods for configuration
     void setUserInterfaceActive(bool isActive);
@@ -65,6 +68,7 @@ private:
     std::vector<StatusEntry> status_updates;
     bool isInputFileValid;
     bool isDataReadSuccessful;
+    std::recursive_mutex logMutex; // detectors can be processed by several worker threads
 
     // Helper function declarations
     std::string getCurrentTime();
@@ -15,42 +15,156 @@
  * @param inputFilePath The path to the input file.
  * @param savePath The path where output files will be saved.
  * @param delila_name The name for TH2 histogram where the data is stored.
+ * @param enabledOutputs Bit mask of OutputFile values, only these output files are created.
+ *
+ * With setKeepPreviousOutputs(true) (incremental runs) the JSON and ROOT outputs of the previous run are
+ * renamed to `<file>.previous` instead of being overwritten, so their unchanged detectors can be copied
+ * into the new files; the `.previous` files are removed by closeFiles().
+ *
+ * Output writer: after startOutputWriter() the jobs given to submitOutput() (writing finished detectors,
+ * saving the combined TH2, ...) run on a dedicated thread, one after the other in submission order, so
+ * the thread that submits them never waits on serialization, compression or the disk. Only a few jobs
+ * can wait in the queue (the submitter blocks beyond that, which bounds the memory they hold).
+ * finishOutputWriter() waits for the queue to drain and returns the time the writer was busy. Without
+ * a started writer submitOutput() runs the job right away.
+ *
+ * Compression profiles: every ROOT output file is created with the compression of its profile (-compress):
+ * - default: ROOT's general purpose default (kUseGeneralPurpose, the algorithm depends on the ROOT version), as before
+ * - none: uncompressed, the fastest to write and the largest files
+ * - fast: LZ4 level 1, for quick-look processing
+ * - archive: ZSTD level 9, for long-term storage (smallest files, slowest to write)
+ * benchmarkCompression() writes the input spectra once per profile and logs the write time and file size.
+ *
+ * The input can also be a RawSpectraFile (recognized by its magic, whatever the extension). It is
+ * mapped instead of read; getTH2Histogram() then returns an empty TH2F with its axes, in which the
+ * combined histogram is built, and the counts are read through getRawSpectra().
+ * After setListModeInput() the input is a ROOT file with a list-mode event tree instead of a TH2: the
+ * spectra of the given domains are filled by openFiles() (see ListModeSpectra) and read through
+ * getListModeSpectra(), getTH2Histogram() again returns an empty TH2F with their axes.
+ * A TH2 of a ROOT input is read on the first getTH2Histogram() after openFiles() and owned by the
+ * FileManager until closeFiles(); later calls return the same object.
  */
 #ifndef FILEMANAGER_H
 #define FILEMANAGER_H
 
 //#include <string>
 #include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <thread>
 #include <TFile.h>
 #include <TH2.h>
+#include "BoundedQueue.h"
+#include "RawSpectraFile.h"
+#include "ListModeSpectra.h"
 
 class FileManager {
+public:
+    // Output sinks that can be selected from the command line (-o)
+    enum OutputFile {
+        JSON_PEAKS = 1 << 0,        // _peaks_data.json
+        ROOT_PEAKS = 1 << 1,        // _peaks.root
+        ROOT_CALIBRATED = 1 << 2,   // _calibrated_histograms.root
+        ROOT_COMBINED = 1 << 3,     // _combinedHistogram.root
+        CALIBRATION_TABLE = 1 << 4, // _calibration_table.bin (see CalibrationTable)
+        ROOT_GAMMA_GAMMA = 1 << 5,  // _calibrated_gammaGamma.root
+        ROOT_PEAK_TREE = 1 << 6,    // _peak_tree.root (see PeakTree)
+        DEFAULT_OUTPUTS = JSON_PEAKS | ROOT_PEAKS | ROOT_CALIBRATED | ROOT_COMBINED,
+        ALL_OUTPUTS = DEFAULT_OUTPUTS | CALIBRATION_TABLE | ROOT_GAMMA_GAMMA | ROOT_PEAK_TREE
+    };
+
+    // Compression of the ROOT output files, selected per file from the command line (-compress)
+    enum CompressionProfile {
+        COMPRESSION_DEFAULT,
+        COMPRESSION_NONE,
+        COMPRESSION_FAST,
+        COMPRESSION_ARCHIVE
+    };
+
+private:
     std::string inputFilePath;
     std::string savePath;
     std::string delila_name;
+    std::string runName;
+    int enabledOutputs;
+    bool keepPreviousOutputs;
+    std::map<OutputFile, CompressionProfile> compressionProfiles;
     TFile* inputFile;
+    RawSpectraFile rawSpectra;
+    ListModeSpectra listModeSpectra;
+    std::string listModeTree; // empty unless the input is a list-mode tree
+    int listModeChannels;
+    std::vector<int> listModeDomains;
+    int listModeThreads;
+    mutable std::unique_ptr<TH2F> inputAxesTH2; // axes of a raw or list-mode input, built on first use
+    mutable std::unique_ptr<TH2F> inputTH2;     // TH2 of a ROOT input, read on first use
+    mutable bool inputTH2Read;                  // the read was tried since openFiles(), it is not repeated
     TFile* outputFileHistograms;
     TFile* outputFileCalibrated;
     TFile* outputFileTH2;
+    TFile* outputFileGammaGamma;
+    TFile* outputFilePeakTree;
     std::ofstream jsonFile;
+    int jsonRecords;
+
+    // Background output writer
+    std::unique_ptr<BoundedQueue<std::function<void()>>> outputQueue;
+    std::thread outputThread;
+    double outputBusySeconds;
+    int outputJobs;
 
 public:
     // Constructor and Destructor
-    FileManager(const std::string& inputFilePath, const std::string& savePath, const std::string& delila_name);
+    FileManager(const std::string& inputFilePath, const std::string& savePath, const std::string& delila_name,
+                int enabledOutputs = DEFAULT_OUTPUTS);
     ~FileManager();
 
     // Functions for opening and closing files
-    void openFiles();
+    bool openFiles(); // false when the input or an output could not be opened
     void closeFiles();
+    // Points the manager at another run, the files of the previous one are closed
+    void setInput(const std::string& inputFilePath, const std::string& savePath);
 
     // Getters for private members
     TH2F* getTH2Histogram() const;
+    TDirectory* getInputDirectory(const std::string& name) const;
     const TFile* getInputFile() const { return inputFile; }
-    std::ofstream& getJsonFile() { return jsonFile; } // Remain non-const if jsonFile needs to be modified
+    // Counts of a raw spectra input, nullptr when the input is a ROOT file
+    const RawSpectraFile* getRawSpectra() const { return rawSpectra.isOpen() ? &rawSpectra : nullptr; }
+    // Spectra of a list-mode input, nullptr when the input is a TH2
+    const ListModeSpectra* getListModeSpectra() const { return listModeSpectra.isLoaded() ? &listModeSpectra : nullptr; }
+    void setListModeInput(const std::string& treeName, int channels, const std::vector<int>& domains, int threads);
     TFile* getOutputFileHistograms() { return outputFileHistograms; }
     TFile* getOutputFileCalibrated() { return outputFileCalibrated; }
     const TFile* getOutputFileTH2() const { return outputFileTH2; }
+    TFile* getOutputFileGammaGamma() { return outputFileGammaGamma; }
+    TFile* getOutputFilePeakTree() { return outputFilePeakTree; }
     const std::string getSavePath() const { return savePath; }
+    const std::string &getRunName() const { return runName; }
+    bool isOutputEnabled(OutputFile output) const { return (enabledOutputs & output) != 0; }
+    int getEnabledOutputs() const { return enabledOutputs; }
+    std::string getOutputFilePath(const std::string &suffix) const { return savePath + runName + suffix; }
+    std::string getPreviousOutputFilePath(const std::string &suffix) const { return getOutputFilePath(suffix) + ".previous"; }
+    void setKeepPreviousOutputs(bool keep) { keepPreviousOutputs = keep; }
+    // Compression profiles, outputs without a profile use COMPRESSION_DEFAULT
+    void setCompressionProfiles(const std::map<OutputFile, CompressionProfile>& profiles) { compressionProfiles = profiles; }
+    int getCompressionSettings(OutputFile output) const;
+    static int getCompressionSettings(CompressionProfile profile);
+    static const char* getCompressionProfileName(CompressionProfile profile);
+    static bool parseCompressionProfile(const std::string& name, CompressionProfile& profile);
+    void benchmarkCompression();
+    // _peaks_data.json is one array, every detector is one record (see JsonWriter)
+    void writeJsonRecord(const std::string& record);
+    void finishJsonFile();
+    static std::map<int, std::string> readJsonRecords(const std::string& path);
+    static bool writeJsonRecords(const std::string& path, const std::map<int, std::string>& records);
+    // Background output writer, see the class description
+    void startOutputWriter(size_t queueDepth);
+    void submitOutput(std::function<void()> job);
+    double finishOutputWriter();
+    bool isOutputWriterRunning() const { return outputThread.joinable(); }
+
     // Functions for saving and updating histograms
     void saveTH2Histogram(TH2F* const th2Histogram);
     void updateHistogramName(TH2F* const histogram);
@@ -60,6 +174,8 @@ private:
     std::string removeFileExtension() const;
     std::string extractRunNumber() const;
     std::string extractDirectoryPath() const;
+    void keepPreviousOutput(const std::string& suffix);
+    void removePreviousOutputs();
 };
 
 #endif // FILEMANAGER_H
@@ -16,6 +16,9 @@
  *        - **Data Export**: Outputs results in JSON format and ROOT files, making it easier
  *          to share and analyze calibrated data and peak characteristics.
  *
+ *        A Histogram owns its spectra (main, working copy and calibrated) and is move-only,
+ *        none of them is attached to a ROOT directory.
+ *
  *        All functions in this class are custom-built, including peak detection,
  *        calibration degree determination, and mathematical problem-solving utilities,
  *        utilizing only the standard capabilities of C++.
@@ -40,19 +43,23 @@
 #define HISTOGRAM_H
 
 #include "Peak.h"
+#include "CalibrationRebinner.h"
+#include "CalibrationCache.h"
+#include "JsonWriter.h"
 #include <TH1D.h>
 #include <TF1.h>
 #include <TFile.h>
 #include <vector>
 #include <string>
+#include <memory>
 
 class Histogram
 {
 private:
     // Core histogram data
-    TH1D *mainHist;
-    TH1D *tempHist;
-    TH1D *calibratedHist;
+    std::unique_ptr<TH1D> mainHist;
+    std::unique_ptr<TH1D> tempHist;       // working copy, found peaks are removed from it
+    std::unique_ptr<TH1D> calibratedHist; // only built when a calibrated spectrum is needed
     std::vector<Peak> peaks;
     std::vector<double> coefficients;
 
@@ -81,6 +88,10 @@ private:
     float totalArea;
     float totalAreaError;
 
+    // Non-empty bin range of mainHist, per-bin loops skip the empty tails
+    int activeFirstBin;
+    int activeLastBin;
+
     // Private methods for peak detection and fitting
     void eliminatePeak(const Peak &peak);
     TF1 *createGaussianFit(int maxBin);
@@ -90,15 +101,12 @@ private:
     bool checkConditions(const Peak &peak) const;
     bool extractDataForFit(std::vector<double> &xValues, std::vector<double> &yValues);
     bool areCoefficientsValid(TF1 *fitFunction, int degree, double threshold);
-    void setCalibratedBinContent(int original_bin);
     std::string getMainHistName() const;
     void findStartOfPeak(Peak &peak);
 
     // Private methods for calibration
-    double evaluateCalibrationPolynomial(double x) const;
     void initializeCalibratedHist();
-    void interpolateBins(int start_bin, int end_bin, double start_value, double end_value,
-                         double start_position, double end_position);
+    CalibrationRebinner createRebinner() const;
     bool checkPredictedEnergies(double predictedEnergy, const double knownEnergies[],
                                 int size, float errorAdmitted, double &valueAssociatedWith) const;
 
@@ -107,28 +115,39 @@ public:
     Histogram();
     Histogram(int xMin, int xMax, int maxFWHM, float minAmplitude, float maxAmplitude,
               const std::string &serial, int detType, float polynomialFitThreshold,
-              int numberOfPeaks, TH1D *mainHist, const std::string &TH2histogram_name,
+              int numberOfPeaks, std::unique_ptr<TH1D> mainHist, const std::string &TH2histogram_name,
               const std::string &sourceName);
     ~Histogram();
-    Histogram(const Histogram &histogram);
-    Histogram &operator=(const Histogram &histogram);
+    Histogram(Histogram &&histogram) = default;
+    Histogram &operator=(Histogram &&histogram) = default;
+    Histogram(const Histogram &histogram) = delete;
+    Histogram &operator=(const Histogram &histogram) = delete;
 
     // Core functionality
     void findPeaks();
     void calibratePeaks(const double knownEnergies[], int size);
     void calibratePeaksByDegree();
     void applyXCalibration();
+    void applyXCalibration(float *calibratedColumn) const; // one column (nBins + 2 values) of the combined TH2 buffer
     void changePeak(int peakNumber, double newPosition);
+    void setActiveRange(int firstBin, int lastBin);
+    // Peaks and polynomial as stored in the CalibrationCache, importResults() replaces findPeaks() + calibratePeaks()
+    CalibrationCache::Result exportResults() const;
+    void importResults(const CalibrationCache::Result &result, const std::string &source); // source is only logged
 
     // Output methods
-    void outputPeaksDataJson(std::ofstream &file);
+    void outputPeaksDataJson(JsonWriter &writer);
     void printHistogramWithPeaksRoot(TFile *outputFile);
     void printCalibratedHistogramRoot(TFile *outputFile) const;
 
     // Getters and setters
-    TH1D *getCalibratedHist() const { return calibratedHist; }
-    TH1D *getMainHist() const { return mainHist; }
+    TH1D *getCalibratedHist() const { return calibratedHist.get(); }
+    TH1D *getMainHist() const { return mainHist.get(); }
     unsigned int getPeakMatchCount() const { return peakMatchCount; }
+    const std::vector<double> &getCoefficients() const { return coefficients; }
+    const std::vector<Peak> &getPeaks() const { return peaks; }
+    const std::string &getSerial() const { return serial; }
+    int getDetType() const { return detType; }
     float getPT();
     float getPTError();
     void setTotalArea();
@@ -0,0 +1,73 @@
+/**
+ * @class JsonWriter
+ * @brief Streaming JSON formatter into a reusable buffer, used for the peak records and the log file.
+ *
+ * Values are appended to an internal std::string; commas, indentation and string escaping are handled
+ * by the writer, so the output is always valid JSON. Numbers are formatted with std::to_chars (shortest
+ * representation that reads back to the same value, independent of the locale; a float is written
+ * with the digits of a float, not those of the widened double); NaN and infinities are written as null. clear() keeps the capacity of the buffer, so a writer that is reused for every
+ * record does not allocate once it has grown to the size of the largest one.
+ *
+ * Containers opened with compact = true are written on one line ("[1.5, 0.2]"), the others with one
+ * element per line, indented by depth. Nesting deeper than MAX_DEPTH is not supported.
+ *
+ * Example usage:
+ *     JsonWriter writer("\t", 1);
+ *     writer.beginObject();
+ *     writer.key("domain"); writer.value(12);
+ *     writer.key("PT"); writer.beginArray(true); writer.value(0.5); writer.value(0.01); writer.endArray();
+ *     writer.endObject();
+ *     file << writer.str();
+ */
+
+#ifndef JSONWRITER_H
+#define JSONWRITER_H
+
+#include <cstdint>
+#include <string>
+
+class JsonWriter
+{
+private:
+    static const int MAX_DEPTH = 16;
+
+    std::string buffer;
+    std::string indent;
+    int baseDepth;
+    int depth;
+    bool hasElements[MAX_DEPTH];
+    bool compact[MAX_DEPTH];
+    bool afterKey;
+
+    void beginValue();
+    void newLine(int level);
+    void appendNumber(double number);
+    void appendNumber(float number);
+    void appendString(const std::string &text);
+    void beginContainer(char open, bool compactContainer);
+    void endContainer(char close);
+
+public:
+    // Every line is indented by baseDepth + depth copies of indent
+    explicit JsonWriter(const std::string &indent = "\t", int baseDepth = 0);
+
+    void beginObject(bool compact = false) { beginContainer('{', compact); }
+    void endObject() { endContainer('}'); }
+    void beginArray(bool compact = false) { beginContainer('[', compact); }
+    void endArray() { endContainer(']'); }
+
+    void key(const std::string &name);
+    void key(double number); // numeric keys, e.g. the energy of a source line
+    void value(double number);
+    void value(float number);
+    void value(int number) { value(static_cast<int64_t>(number)); }
+    void value(int64_t number);
+    void value(const std::string &text);
+    void value(const char *text) { value(std::string(text)); }
+    void value(bool flag);
+
+    const std::string &str() const { return buffer; }
+    void clear();
+};
+
+#endif // JSONWRITER_H
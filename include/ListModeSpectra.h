@@ -0,0 +1,72 @@
+/**
+ * @class ListModeSpectra
+ * @brief Spectra of the LUT detectors built in one parallel pass over a list-mode event TTree.
+ *
+ * Upstream, mDelila_raw is filled from event trees in a separate step. With -listMode the input
+ * file is read as events instead: every entry of the tree is one hit with the branches
+ *     domain  (Int_t)  detector domain, the TH2 column
+ *     channel (Int_t)  ADC channel, channel c goes to bin c + 1, bins 1..numberOfChannels
+ * Only these two branches are read. The tree is processed cluster by cluster on ROOT's thread pool
+ * (ROOT::TTreeProcessorMT); hits of domains that are not in the LUT are skipped (their channel is
+ * never read) and the others are counted into per-task buffers that are summed at the end.
+ *
+ * The result has the layout of a ColumnMatrix: one contiguous span of numberOfChannels + 2 counts
+ * per LUT detector (underflow, channels, overflow), so ColumnMatrix and ColumnStatistics read the
+ * spans in place. createEmptyHistogram() gives a TH2F with matching axes for the combined output.
+ *
+ * Example usage:
+ *     ListModeSpectra spectra;
+ *     spectra.read("run_152.root", "events", lutDomains, 16384, 8);
+ *     const float *counts = spectra.getColumn(12); // nullptr for domains outside the LUT
+ */
+
+#ifndef LISTMODESPECTRA_H
+#define LISTMODESPECTRA_H
+
+#include <TH2.h>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class ListModeSpectra
+{
+private:
+    std::vector<float> values; // columnSize counts per LUT detector
+    std::vector<int> slots;    // column -> position in values, -1 outside the LUT
+    int numberOfColumns;
+    int numberOfChannels;
+
+    // Count buffers of the tasks that run concurrently, reused by the following tasks
+    std::vector<std::unique_ptr<std::vector<uint32_t>>> freeBuffers;
+    std::mutex bufferMutex;
+
+    std::unique_ptr<std::vector<uint32_t>> acquireBuffer(size_t size);
+    void releaseBuffer(std::unique_ptr<std::vector<uint32_t>> buffer);
+
+public:
+    static const int DEFAULT_CHANNELS = 16384;
+
+    ListModeSpectra();
+
+    bool read(const std::string &path, const std::string &treeName, const std::vector<int> &domains,
+              int channels, int numberOfThreads);
+    void clear();
+    bool isLoaded() const { return !slots.empty(); }
+
+    int getNumberOfColumns() const { return numberOfColumns; }
+    int getNumberOfChannels() const { return numberOfChannels; }
+    int getColumnSize() const { return numberOfChannels + 2; }
+    double getChannelMin() const { return 0; }
+    double getChannelMax() const { return numberOfChannels; }
+    const float *getValues() const { return values.data(); }
+    int getSlot(int column) const;
+
+    // numberOfChannels + 2 counts of one detector, nullptr for domains outside the LUT
+    const float *getColumn(int column) const;
+    // TH2F with the axes of the spectra and no counts, the combined histogram is built in it
+    std::unique_ptr<TH2F> createEmptyHistogram(const std::string &name) const;
+};
+
+#endif // LISTMODESPECTRA_H
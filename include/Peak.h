@@ -92,6 +92,7 @@ public:
     void setAmplitude(double amp) { amplitude = amp; }
     void setSigma(double sig) { sigma = sig; }
     void setArea(double a) { area = a; }
+    void setAreaError(double error) { areaError = error; }
     void setLeftLimit(float left) { leftLimit = left; }
     void setRightLimit(float right) { rightLimit = right; }
 };
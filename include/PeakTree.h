@@ -0,0 +1,64 @@
+/**
+ * @class PeakTree
+ * @brief Columnar peak results: the TTree "peaks" of `<run>_peak_tree.root`, one row per fitted peak.
+ *
+ * _peaks_data.json nests the peaks of a detector under their energy, so reading it back means parsing
+ * every record. The same results are written here as flat branches:
+ *     run, domain, detType (int), serial (std::string),
+ *     energy, position, sigma, area, areaError, resolution, PT (double)
+ * so an analysis over many runs reads only the branches it uses, e.g.
+ *     ROOT::RDataFrame df("peaks", "*_peak_tree.root");
+ *     df.Filter("energy == 1408.006").Histo1D("resolution");
+ * energy is the source line the peak was matched to, position its centroid in channels and PT the
+ * peak-to-total ratio of the detector (the same value on all its rows).
+ *
+ * Rows are filled while the detectors are written and the tree is written by write(), before its
+ * file is closed. With -incremental the rows of the reused detectors are copied from the previous file.
+ *
+ * Example usage:
+ *     PeakTree peakTree;
+ *     peakTree.create(outputFile, run);
+ *     peakTree.fill(hist, domain);
+ *     peakTree.write();
+ */
+
+#ifndef PEAKTREE_H
+#define PEAKTREE_H
+
+#include "Histogram.h"
+#include <TFile.h>
+#include <TTree.h>
+#include <set>
+#include <string>
+
+class PeakTree
+{
+private:
+    TFile *file;
+    TTree *tree; // owned by file
+
+    // Row buffer, the branches point at these members
+    int run;
+    int domain;
+    int detType;
+    std::string serial;
+    double energy;
+    double position;
+    double sigma;
+    double area;
+    double areaError;
+    double resolution;
+    double PT;
+
+public:
+    PeakTree();
+
+    bool create(TFile *outputFile, int runNumber);
+    void fill(Histogram &hist, int domainNumber);
+    int copyRows(const std::string &previousPath, const std::set<int> &domains);
+    void write();
+
+    bool isOpen() const { return tree != nullptr; }
+};
+
+#endif // PEAKTREE_H
@@ -0,0 +1,99 @@
+/**
+ * @class RawSpectraFile
+ * @brief Memory-mapped input in a flat binary layout, every detector column is a span of the mapping.
+ *
+ * Reading mDelila_raw from a ROOT file decompresses and deserializes the whole TH2F before a single
+ * column can be used. A raw spectra file holds the same counts uncompressed and column-major, so after
+ * mmap() a column is read straight from the page cache, and only the pages of the columns that are
+ * processed are ever read from disk.
+ *
+ * File layout (little-endian, see Header):
+ *     offset  0  char[8]  magic "ELISPEC1"
+ *             8  uint32   headerSize, offset of the counts (64)
+ *            12  uint32   dtype: 1 = float32, 2 = uint32
+ *            16  int32    numberOfColumns (x bins of the TH2, the domains)
+ *            20  int32    numberOfChannels (y bins of the TH2)
+ *            24  double   columnMin, columnMax (x axis range)
+ *            40  double   channelMin, channelMax (y axis range, uniform bins)
+ *            56  uint32   reserved[2], 0
+ *     headerSize  counts[numberOfColumns + 2][numberOfChannels + 2]
+ * Column c (the TH2 x bin c, 0 and numberOfColumns + 1 are under/overflow) is the contiguous block
+ * counts[c], in the TH1 layout: underflow, numberOfChannels channels, overflow.
+ *
+ * With float32 counts getColumn() returns a pointer into the mapping (zero copy); uint32 counts (as
+ * written by a DAQ) are converted by copyColumn(). writeFromHistogram() converts a TH2F (-convertRaw).
+ *
+ * Example usage:
+ *     RawSpectraFile spectra;
+ *     spectra.open("run_152.spectra");
+ *     const float *counts = spectra.getColumn(12); // counts[0] is the underflow
+ */
+
+#ifndef RAWSPECTRAFILE_H
+#define RAWSPECTRAFILE_H
+
+#include <TH2.h>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+class RawSpectraFile
+{
+public:
+    enum DataType
+    {
+        FLOAT32 = 1,
+        UINT32 = 2
+    };
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t headerSize;
+        uint32_t dtype;
+        int32_t numberOfColumns;
+        int32_t numberOfChannels;
+        double columnMin;
+        double columnMax;
+        double channelMin;
+        double channelMax;
+        uint32_t reserved[2];
+    };
+
+private:
+    std::string path;
+    const char *mapping;
+    size_t mappingSize;
+    Header header;
+
+    const char *getColumnData(int column) const;
+
+public:
+    RawSpectraFile();
+    ~RawSpectraFile();
+    RawSpectraFile(const RawSpectraFile &) = delete;
+    RawSpectraFile &operator=(const RawSpectraFile &) = delete;
+
+    static bool isRawSpectraFile(const std::string &path);
+    static bool writeFromHistogram(const TH2F &histogram, const std::string &path);
+
+    bool open(const std::string &path);
+    void close();
+    bool isOpen() const { return mapping != nullptr; }
+
+    int getNumberOfColumns() const { return header.numberOfColumns; }
+    int getNumberOfChannels() const { return header.numberOfChannels; }
+    int getColumnSize() const { return header.numberOfChannels + 2; }
+    double getChannelMin() const { return header.channelMin; }
+    double getChannelMax() const { return header.channelMax; }
+    bool isZeroCopy() const { return header.dtype == FLOAT32; }
+
+    // numberOfChannels + 2 counts of one column, nullptr for uint32 files or columns out of range
+    const float *getColumn(int column) const;
+    void copyColumn(int column, float *target) const;
+    // TH2F with the axes of the file and no counts, the combined histogram is built in it
+    std::unique_ptr<TH2F> createEmptyHistogram(const std::string &name) const;
+};
+
+#endif // RAWSPECTRAFILE_H
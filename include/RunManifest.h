@@ -0,0 +1,65 @@
+/**
+ * @class RunManifest
+ * @brief Records what every detector of a run was computed from, for incremental re-calibration.
+ *
+ * Every run writes `<run>_manifest.json` next to its outputs. It holds:
+ * - a settings hash: sources, energy array, global fit options, enabled outputs and the TH2 binning
+ * - per detector (domain): a hash of its raw column contents and of its LUT entry, and the
+ *   calibration polynomial that was found
+ *
+ * With `-incremental` the next run of the same file compares its own hashes with the manifest:
+ * detectors with the same hash are not fitted again, their previous outputs are kept. A different
+ * settings hash (or no manifest) means a full run.
+ *
+ * Hashes are 64-bit FNV-1a, stored as hex strings (JSON numbers are not exact above 2^53).
+ *
+ * Example usage:
+ *     RunManifest manifest;
+ *     if (manifest.readFromFile(path) && manifest.getSettingsHash() == settings)
+ *         const RunManifest::Entry *entry = manifest.findEntry(domain);
+ */
+
+#ifndef RUNMANIFEST_H
+#define RUNMANIFEST_H
+
+#include <cstdint>
+#include <cstddef>
+#include <map>
+#include <string>
+#include <vector>
+
+class RunManifest
+{
+public:
+    struct Entry
+    {
+        uint64_t hash = 0;                 // column contents + LUT entry
+        std::vector<double> coefficients; // calibration polynomial of the detector
+    };
+
+    static const uint64_t HASH_SEED = 14695981039346656037ULL; // FNV-1a offset basis
+
+    static uint64_t hashBytes(const void *data, size_t size, uint64_t hash = HASH_SEED);
+    static uint64_t hashString(const std::string &text, uint64_t hash = HASH_SEED);
+    template <typename T>
+    static uint64_t hashValue(const T &value, uint64_t hash = HASH_SEED) { return hashBytes(&value, sizeof(T), hash); }
+
+private:
+    uint64_t settingsHash;
+    std::map<int, Entry> entries; // domain -> entry
+
+public:
+    RunManifest();
+
+    void clear();
+    bool readFromFile(const std::string &path);
+    bool writeToFile(const std::string &path) const;
+
+    void setSettingsHash(uint64_t hash) { settingsHash = hash; }
+    uint64_t getSettingsHash() const { return settingsHash; }
+    void setEntry(int domain, const Entry &entry) { entries[domain] = entry; }
+    const Entry *findEntry(int domain) const;
+    const std::map<int, Entry> &getEntries() const { return entries; }
+};
+
+#endif // RUNMANIFEST_H
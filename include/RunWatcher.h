@@ -0,0 +1,50 @@
+/**
+ * @class RunWatcher
+ * @brief Waits for new run files in a directory (Linux inotify), used by the watch mode.
+ *
+ * A file is reported once it is complete: closed after writing (IN_CLOSE_WRITE) or moved into
+ * the directory (IN_MOVED_TO, e.g. written elsewhere and renamed). Only files that match the run
+ * pattern of ArgumentsManager::getHistogramFilename are reported: `_<run number>_` in the name and
+ * the `.root` extension (e.g. selected_run_152_eliade.root).
+ *
+ * SIGINT / SIGTERM stop the watch: waitForRun() returns an empty path and the caller finishes
+ * the run it is processing before leaving.
+ *
+ * Example usage:
+ *     RunWatcher watcher("data/");
+ *     if (watcher.start())
+ *         for (std::string file = watcher.waitForRun(); !file.empty(); file = watcher.waitForRun())
+ *             process(file);
+ */
+
+#ifndef RUNWATCHER_H
+#define RUNWATCHER_H
+
+#include <string>
+#include <deque>
+
+class RunWatcher
+{
+private:
+    std::string directory;
+    int inotifyDescriptor;
+    int watchDescriptor;
+    std::deque<std::string> pendingFiles; // complete files of one read, in arrival order
+
+    void readEvents();
+
+public:
+    explicit RunWatcher(const std::string &directory);
+    ~RunWatcher();
+    RunWatcher(const RunWatcher &) = delete;
+    RunWatcher &operator=(const RunWatcher &) = delete;
+
+    bool start();
+    std::string waitForRun(); // path of the next complete run file, empty when the watch is stopped
+    const std::string &getDirectory() const { return directory; }
+
+    static int findRunNumber(const std::string &fileName); // -1 when the name is not a run file
+    static bool isStopRequested();
+};
+
+#endif // RUNWATCHER_H
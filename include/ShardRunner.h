@@ -0,0 +1,60 @@
+/**
+ * @class ShardRunner
+ * @brief Splits a run into domain shards processed by separate processes and merges their outputs.
+ *
+ * The LUT detectors are split evenly over the shards. Every shard is this same executable started
+ * again with `-d <first> <last>` and its own save directory (`<save path>/shard_<k>/`). The shards
+ * run concurrently as independent processes, so a ROOT crash on a bad detector only loses the
+ * domains of that shard. When all shards are finished their outputs are merged into the normal
+ * output files of the run:
+ * - the records of `_peaks_data.json` are merged into one array, in domain order
+ * - `_peaks.root`, `_calibrated_histograms.root`, `_calibrated_gammaGamma.root` are merged like hadd
+ * - the partial combined TH2 of every shard only holds its own columns, merging sums them
+ * - `_calibration_table.bin` files are joined into one table
+ *
+ * A shard that crashed or exited with a non-zero code is left out of the merge (its outputs may be
+ * partial) and run() returns false, so the exit code of the main process is non-zero.
+ *
+ * With `-merge <N>` only the merge step is done, e.g. after re-running a crashed shard by hand.
+ *
+ * Example usage:
+ *     ./task -hf 152 -j LUT.json -sh 8 -w 2 -s 152Eu
+ *     ./task -hf 152 -j LUT.json -merge 8 -s 152Eu
+ */
+
+#ifndef SHARDRUNNER_H
+#define SHARDRUNNER_H
+
+#include "FileManager.h"
+#include <string>
+#include <vector>
+#include <set>
+#include <utility>
+
+class ArgumentsManager; // ArgumentsManager.h has no include guard
+
+class ShardRunner
+{
+private:
+    ArgumentsManager &argumentsManager;
+    FileManager fileManager; // input only, resolves the save directory and run name
+    std::vector<std::string> arguments; // command line without the options set per shard
+    int numberOfShards;
+    std::set<int> failedShards; // not merged
+
+    std::vector<std::pair<int, int>> splitDomains() const;
+    std::string getShardDirectory(int shard) const;
+    std::string getShardFilePath(int shard, const std::string &suffix) const;
+    bool launchShards(const std::vector<std::pair<int, int>> &domains);
+    bool mergeShards();
+    bool isMerged(int shard, const std::string &path) const;
+    bool mergeJsonFiles(const std::string &suffix);
+    bool mergeRootFiles(const std::string &suffix, FileManager::OutputFile output);
+    bool mergeCalibrationTables(const std::string &suffix);
+
+public:
+    ShardRunner(ArgumentsManager &args, int argc, char *argv[]);
+    bool run(); // false when a shard failed or a merge could not be written
+};
+
+#endif // SHARDRUNNER_H
@@ -6,11 +6,31 @@
  * The TaskHandler class is responsible for coordinating all tasks within the program.
  * 
  * @method executeHistogramProcessingTask Executes the main task.
+ * @method executeBatchTask Runs the main task for every run of -runs / -jobs, the setup is shared.
+ * @method executeWatchTask Runs the main task for every new run file of the -watch directory, until SIGINT / SIGTERM.
+ * @method processRun Processes one run of a batch or of the watch mode.
+ * @method resetRunState Drops everything that belongs to the previous run of a batch.
  * @method initializeEnergyArray Initializes the energy array with calibrated sources.
  * @method process2DHistogram Processes all histograms.
  * @method processSingleHistogram Processes a single histogram.
+ * @method processColumnsInPipeline Runs extraction, fitting and writing as concurrent stages, outputs stay in column order.
+ * @method configureParallelProcessing Sets up the worker pool of the pipeline, -w 1 and the User Interface keep the serial loop.
+ * @method extractColumns Pipeline stage: builds the column spectra from the ColumnMatrix and prepares their histograms.
+ * @method loadColumnMatrix Loads the columns of a range of processingPlan, from the input TH2, the raw spectra file or the list-mode spectra.
+ * @method fitColumn Pipeline stage: finds the peaks, calibrates and formats the JSON record of one column on the worker pool.
+ * @method writeColumns Pipeline stage: writes the outputs of one batch, runs on the output writer of the FileManager.
+ * @method hashPlannedColumns Hashes the inputs of every planned detector for the run manifest.
+ * @method planIncrementalRun With -incremental, keeps only the detectors whose inputs changed since the previous run.
+ * @method spliceReusedDetectors Copies the previous results of the unchanged detectors into the new outputs.
+ * @method analyzeHistogram Finds the peaks and the polynomial of one detector, or takes them from the journal (-resume) or the CalibrationCache.
+ * @method buildProcessingPlan Lists the LUT detectors of the domain range that have data, only those are processed.
+ * @method estimateColumnCosts Estimates the fitting cost of every column for the scheduler.
+ * @method logWorkerUtilization Logs how busy every fit worker was.
  * @method combineHistogramsIntoTH2 Combines histograms into a 2D histogram.
- * @method fillTH2FromHistograms Fills the 2D histogram from 1D histograms.
+ * @method storeCalibratedColumn Replaces a raw column of the input TH2 by its calibrated spectrum.
+ * @method clearUncalibratedColumns Empties the columns that were not calibrated, the TH2 is then the combined histogram.
+ * @method saveCalibrationTable Exports the per-detector calibration lookup table.
+ * @method calibrateGammaGammaMatrices Calibrates both axes of the coincidence matrices in GammaGamma.
  */
 
 #ifndef TASKHANDLER_H
@@ -21,7 +41,20 @@
 #include "Peak.h"
 #include "UserInterface.h"
 #include "ArgumentsManager.h"
+#include "CalibrationTable.h"
+#include "WorkerPool.h"
+#include "ColumnStatistics.h"
+#include "ColumnMatrix.h"
+#include "RunManifest.h"
+#include "CalibrationCache.h"
+#include "CheckpointJournal.h"
+#include "PeakTree.h"
 #include <vector>
+#include <map>
+#include <set>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
 
 class TaskHandler
 {
@@ -33,18 +66,84 @@ private:
     int size;
     TH2F *inputTH2;
     std::vector<Histogram> histograms;
+    std::vector<char> calibratedColumnsDone; // column -> calibrated spectrum stored in inputTH2, empty without the th2 output
+    CalibrationTable calibrationTable;
+    PeakTree peakTree;
+    JsonWriter jsonWriter{"\t", 1}; // records of the serial path, outputs are written one at a time
+    std::vector<int> processingPlan;                 // columns to process, ascending, built from the LUT
+    std::vector<ColumnStatistics> columnStatistics; // preflight pass over the planned TH2 columns, indexed by column
+    ColumnMatrix columnMatrix;                       // contiguous copies of the columns of the current batch
+    std::map<int, std::vector<double>> detectorCoefficients; // domain -> calibration polynomial
+    std::unique_ptr<WorkerPool> workerPool;                   // fit stage of the pipeline, not used with the User Interface
+    RunManifest manifest;                                     // inputs and results of this run, see -incremental
+    std::map<int, uint64_t> columnHashes;                     // column -> hash of its counts and LUT entry
+    std::vector<int> reusedColumns;                           // unchanged since the previous run, not fitted again
+    uint64_t fitSettingsHash = 0;                             // settings shared by all detectors that change the fits
+    std::unique_ptr<CalibrationCache> calibrationCache;       // -cache, results of earlier runs with the same inputs
+    CheckpointJournal journal;                                // finished detectors of this run, see -resume
 
 public:
     TaskHandler(ArgumentsManager &args);
     ~TaskHandler();
-    void executeHistogramProcessingTask();
+    // false when the run (or a run of the batch) could not be processed, main() turns it into the exit code
+    bool executeHistogramProcessingTask();
+    bool executeBatchTask();
+    bool executeWatchTask();
 
 private:
     double *initializeEnergyArray();
     void process2DHistogram();
-    void processSingleHistogram(TH1D *const hist1D);
+    bool prepareSharedSetup();
+    bool processRun(const std::string &histogramFilePath, const std::string &savePath);
+    void resetRunState();
+    void writeRunStatus(const std::string &histogramFilePath, bool processed, double seconds);
+    void configureParallelProcessing();
+    void processSingleHistogram(std::unique_ptr<TH1D> hist1D, int column);
+    // Consecutive entries of the processing plan travelling together through the pipeline stages
+    struct ColumnBatch
+    {
+        size_t firstJob = 0; // position of the first column in processingPlan
+        std::vector<std::unique_ptr<Histogram>> histograms; // null for skipped or failed columns
+        std::vector<std::string> jsonRecords; // formatted by the fit workers, empty without the JSON output
+        int remainingFits = 0;                // columns of the batch still on the worker pool
+    };
+    // Batches between extraction and output; their fits are one continuous job stream of the worker pool
+    struct ColumnPipeline
+    {
+        size_t batchSize = 0;
+        std::vector<std::shared_ptr<ColumnBatch>> batches; // by batch number, set once extracted
+        size_t batchesInFlight = 0;                        // extracted and not yet handed to the output writer
+        std::mutex mutex;                                  // guards the fields above and remainingFits
+        std::condition_variable changed;
+    };
+    void processColumnsInPipeline();
+    double extractColumns(ColumnPipeline &pipeline, const std::vector<double> &costs);
+    void fitColumn(ColumnPipeline &pipeline, int job);
+    void loadColumnMatrix(size_t firstJob, size_t endJob);
+    void writeColumns(ColumnBatch &batch);
+    std::vector<double> estimateColumnCosts() const;
+    void logWorkerUtilization(const std::vector<WorkerPool::WorkerStatistics> &statistics, double seconds) const;
+    void buildProcessingPlan(int firstColumn, int lastColumn);
+    uint64_t computeFitSettingsHash() const;
+    uint64_t computeSettingsHash() const;
+    uint64_t getCacheKey(int column) const;
+    void openCalibrationCache();
+    void logCacheUsage() const;
+    void hashPlannedColumns();
+    void planIncrementalRun();
+    void spliceReusedDetectors();
+    void spliceJsonOutput(const std::set<int> &reused);
+    void copyPreviousHistograms(const std::string &suffix, TFile *outputFile, const std::set<int> &reused);
+    void copyPreviousCalibratedColumns(const std::set<int> &reused);
+    std::unique_ptr<Histogram> prepareHistogram(std::unique_ptr<TH1D> hist1D, int column);
+    void analyzeHistogram(Histogram &hist, int column);
+    void outputHistogram(Histogram &hist, int column, const std::string *jsonRecord = nullptr);
     void combineHistogramsIntoTH2();
-    void fillTH2FromHistograms();
+    void storeCalibratedColumn(int column, const float *calibratedColumn);
+    void clearUncalibratedColumns();
+    void saveCalibrationTable();
+    void calibrateGammaGammaMatrices();
+    const std::vector<double> *findMatrixCoefficients(const std::string &matrixName) const;
 };
 
 #endif // TASKHANDLER_H
@@ -22,6 +22,7 @@
  * @note This class is designed for extensibility and can be enhanced with additional user interface features as needed.
  */
 #include "Histogram.h"
+#include "FileManager.h"
 #include "CalibrationDataProvider.h"
 
 
@@ -29,7 +30,7 @@ class UserInterface
 {
 public:
 
-    void askAboutPeaks(std::vector<Histogram> &histograms, std::ofstream &jsonFile, TFile *outputFileHistograms, TFile *outputFileCalibrated);
+    void askAboutPeaks(std::vector<Histogram> &histograms, FileManager &fileManager);
     double *askAboutSource(CalibrationDataProvider &energys, int &size, std::string &sourceName, int &numberOfPeaks);
     void showCalibrationInfo(const Histogram &histogram) const;
 
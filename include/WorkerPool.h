@@ -0,0 +1,105 @@
+/**
+ * @class WorkerPool
+ * @brief Fixed set of worker threads that process a batch of independent jobs.
+ *
+ * The threads are created once and reused for every batch. A batch is a number of jobs
+ * and a task called as task(worker, job). start() returns immediately so the calling thread
+ * can consume results while the workers run, wait() blocks until the whole batch is done.
+ *
+ * A stream is a batch whose jobs arrive while it runs: startStream() sets the task, addJobs()
+ * hands over more jobs (any job numbers) and the workers wait for them instead of finishing,
+ * until closeStream() is called and everything queued is done. There is no barrier between
+ * two addJobs() calls, a worker that runs out of jobs goes on with the next ones right away.
+ *
+ * Scheduling:
+ * - An optional cost per job (any unit) orders the batch heaviest-first
+ * - Jobs are dealt round-robin into one queue per worker, so every worker starts on a heavy job
+ * - A worker takes the next job from its own queue and, once it is empty, steals the heaviest
+ *   pending job from the other queues, so a few expensive jobs cannot leave the other cores idle
+ * - Per-worker statistics (jobs, stolen jobs, busy time) are kept for the last batch or stream
+ *
+ * Example usage:
+ *     WorkerPool pool(8);
+ *     pool.start(numberOfColumns, [&](int worker, int job) { fitColumn(job); }, columnCosts);
+ *     pool.wait();
+ *
+ *     pool.startStream([&](int worker, int job) { fitColumn(job); });
+ *     pool.addJobs(nextJobs, nextJobCosts); // as often as needed
+ *     pool.closeStream();
+ *     pool.wait();
+ */
+
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+
+class WorkerPool
+{
+public:
+    struct WorkerStatistics
+    {
+        int jobs = 0;
+        int stolenJobs = 0;
+        double busySeconds = 0;
+    };
+
+private:
+    struct WorkerQueue
+    {
+        std::mutex mutex;
+        std::deque<int> jobs; // heaviest job at the front
+    };
+
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+    std::vector<WorkerStatistics> statistics;
+    std::mutex mutex;
+    std::condition_variable batchAvailable;
+    std::condition_variable batchFinished;
+    std::condition_variable jobsAdded;
+
+    std::function<void(int, int)> task;
+    int numberOfWorkers;
+    unsigned int batchNumber;
+    int activeWorkers;
+    bool stopping;
+    bool streaming;          // the current batch is a stream, workers wait for more jobs
+    bool streamClosed;       // no more jobs will be added to the stream
+    unsigned int jobsVersion; // incremented by every addJobs()
+    int nextQueue;           // queue the next added job is dealt into
+    std::chrono::steady_clock::time_point batchStart;
+    double batchSeconds;
+
+    void workerLoop(int worker);
+    bool takeJob(int worker, int &job, bool &stolen);
+    void dealJobs(std::vector<int> jobs, const std::vector<double> &costs);
+    void beginBatch(std::function<void(int, int)> task, bool stream);
+
+public:
+    explicit WorkerPool(int numberOfWorkers);
+    ~WorkerPool();
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool &operator=(const WorkerPool &) = delete;
+
+    void start(int numberOfJobs, std::function<void(int worker, int job)> task,
+               const std::vector<double> &costs = std::vector<double>());
+    void wait();
+    void startStream(std::function<void(int worker, int job)> task);
+    void addJobs(const std::vector<int> &jobs, const std::vector<double> &costs = std::vector<double>());
+    void closeStream();
+    int getNumberOfWorkers() const { return numberOfWorkers; }
+
+    // Statistics of the last finished batch
+    const std::vector<WorkerStatistics> &getStatistics() const { return statistics; }
+    double getBatchSeconds() const { return batchSeconds; }
+};
+
+#endif // WORKERPOOL_H
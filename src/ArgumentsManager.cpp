@@ -1,18 +1,23 @@
 #include "../include/ArgumentsManager.h"
 #include "../include/ErrorHandle.h"
+#include "../include/FileManager.h"
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <vector>
 #include <unistd.h>
 #include <limits.h>
 #include <algorithm>
+#include <cstdlib>
 #include <dirent.h> // Include dirent.h for directory iteration
 #include <cctype>
+#include <thread>
 #include <nlohmann/json.hpp> // Include nlohmann/json
 
 ArgumentsManager::ArgumentsManager(int argc, char *argv[])
     : energyFilePath(getDataFolderPath()),
-      energyProcessor(energyFilePath)
+      energyProcessor(energyFilePath),
+      outputSinks(FileManager::DEFAULT_OUTPUTS)
 {
     parseArguments(argc, argv);
 }
@@ -29,23 +34,47 @@ void ArgumentsManager::parseArguments(int argc, char *argv[])
         std::string arg = argv[i];
         if (arg == "-hf" || arg == "--histogram_file")
         {
-            std::string input = argv[++i];
-            if (isNumber(input))
+            std::string filename = resolveHistogramFile(argv[++i]);
+            if (!filename.empty())
             {
-                int runNumber = std::stoi(input);
-                std::string filename = getHistogramFilename(runNumber);
-                if (!filename.empty())
-                {
-                    histogramFilePath = filename;
-                }
-                else
-                {
-                    ErrorHandle::getInstance().logStatus("Histogram file for run number " + std::to_string(runNumber) + " not found. Please provide a valid filename.");
-                }
+                histogramFilePath = filename;
             }
-            else
+        }
+        else if (arg == "-runs")
+        {
+            if (!parseRunList(argv[++i]))
+            {
+                printUsage();
+                return;
+            }
+        }
+        else if (arg == "-cache")
+        {
+            cacheDirectory = argv[++i];
+        }
+        else if (arg == "-cacheSize")
+        {
+            cacheSizeMB = std::max(std::atoi(argv[++i]), 1);
+        }
+        else if (arg == "-resume" || arg == "--resume")
+        {
+            resumeRun = true;
+        }
+        else if (arg == "-incremental")
+        {
+            incrementalRun = true;
+        }
+        else if (arg == "-watch")
+        {
+            watchMode = true;
+            watchDirectory = argv[++i];
+        }
+        else if (arg == "-jobs")
+        {
+            if (!parseJobFile(argv[++i]))
             {
-                histogramFilePath = input;
+                printUsage();
+                return;
             }
         }
         else if (arg == "-hn" || arg == "--histogram_name")
@@ -98,6 +127,64 @@ void ArgumentsManager::parseArguments(int argc, char *argv[])
         {
             polynomialFitThreshold = std::stod(argv[++i]);
         }
+        else if (arg == "-nc" || arg == "--no_calibrated_histograms")
+        {
+            outputSinks &= ~FileManager::ROOT_CALIBRATED;
+        }
+        else if (arg == "-w" || arg == "-workers")
+        {
+            numberOfWorkers = std::stoi(argv[++i]);
+            if (numberOfWorkers <= 0)
+            {
+                numberOfWorkers = std::max(1u, std::thread::hardware_concurrency());
+            }
+        }
+        else if (arg == "-sh" || arg == "-shards")
+        {
+            numberOfShards = std::max(std::stoi(argv[++i]), 1);
+        }
+        else if (arg == "-merge")
+        {
+            numberOfShards = std::max(std::stoi(argv[++i]), 1);
+            shardMergeOnly = true;
+        }
+        else if (arg == "-gg" || arg == "-gammaGamma")
+        {
+            gammaGammaReferenceDomain = std::stoi(argv[++i]);
+            outputSinks |= FileManager::ROOT_GAMMA_GAMMA;
+        }
+        else if (arg == "-compress")
+        {
+            if (!parseCompressionProfiles(argv[++i]))
+            {
+                printUsage();
+                return;
+            }
+        }
+        else if (arg == "-listMode")
+        {
+            listModeTree = argv[++i];
+        }
+        else if (arg == "-listModeChannels")
+        {
+            listModeChannels = std::max(std::atoi(argv[++i]), 1);
+        }
+        else if (arg == "-convertRaw")
+        {
+            rawConversionPath = argv[++i];
+        }
+        else if (arg == "-compressionBenchmark")
+        {
+            compressionBenchmark = true;
+        }
+        else if (arg == "-o" || arg == "-outputs")
+        {
+            if (!parseOutputSinks(argv[++i]))
+            {
+                printUsage();
+                return;
+            }
+        }
         else if (arg == "-h" || arg == "--help")
         {
             printUsage();
@@ -139,6 +226,77 @@ bool ArgumentsManager::parseNumericArgument(const char *arg, float &value, float
     return false;
 }
 
+// function to turn a run number (ex: 152) or a file path into the histogram file path, empty if not found
+std::string ArgumentsManager::resolveHistogramFile(const std::string &input) const
+{
+    if (!isNumber(input))
+    {
+        return input;
+    }
+    int runNumber = std::stoi(input);
+    std::string filename = getHistogramFilename(runNumber);
+    if (filename.empty())
+    {
+        ErrorHandle::getInstance().logStatus("Histogram file for run number " + std::to_string(runNumber) + " not found. Please provide a valid filename.");
+    }
+    return filename;
+}
+
+// function to parse a comma separated list of runs or files for the batch mode (ex: 152,153,data/run_160.root)
+bool ArgumentsManager::parseRunList(const std::string &list)
+{
+    size_t start = 0;
+    while (start <= list.size())
+    {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos)
+        {
+            end = list.size();
+        }
+        std::string run = list.substr(start, end - start);
+        if (!run.empty())
+        {
+            std::string filename = resolveHistogramFile(run);
+            if (!filename.empty())
+            {
+                batchJobs.push_back({filename, ""});
+            }
+        }
+        start = end + 1;
+    }
+    return !batchJobs.empty();
+}
+
+// function to read a job file: one run or file per line, optionally followed by its save path, # starts a comment
+bool ArgumentsManager::parseJobFile(const std::string &path)
+{
+    std::ifstream file(path);
+    if (!file.is_open())
+    {
+        std::cerr << "Could not open job file: " << path << '\n';
+        return false;
+    }
+    std::string line;
+    while (std::getline(file, line))
+    {
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        std::string run;
+        std::string runSavePath;
+        if (!(fields >> run))
+        {
+            continue;
+        }
+        fields >> runSavePath;
+        std::string filename = resolveHistogramFile(run);
+        if (!filename.empty())
+        {
+            batchJobs.push_back({filename, runSavePath});
+        }
+    }
+    return !batchJobs.empty();
+}
+
 // function to check if a string is a number
 bool ArgumentsManager::isNumber(const std::string &s) const
 {
@@ -179,7 +337,26 @@ void ArgumentsManager::printUsage() const
               << "  -s, -sources <source...>                      Specify sources\n"
               << "  -j, -json <file>                              Specify JSON configuration file\n"
               << "  -d, -domainLimits <min> <max>                  Set domain limits\n"
-              << "  -c, -calib <threshold>                        Set calibration threshold\n";
+              << "  -c, -calib <threshold>                        Set calibration threshold\n"
+              << "  -nc, --no_calibrated_histograms               Do not write the per-detector calibrated histograms\n"
+              << "  -o, -outputs <sink,sink...>                   Outputs to write: json, peaks, calibrated, th2, table, gg, tree, all\n"
+              << "  -compress <profile | file=profile,...>        ROOT output compression: none, fast (LZ4), default, archive (ZSTD);\n"
+              << "                                                files: peaks, calibrated, th2, gg, tree\n"
+              << "  -listMode <tree>                              The input file holds a list-mode tree (Int_t domain, channel), not a TH2\n"
+              << "  -listModeChannels <N>                         Channels of the spectra filled from the list-mode tree (default 16384)\n"
+              << "  -convertRaw <path>                            Write the input TH2 as a raw spectra file (memory-mapped input), no calibration\n"
+              << "  -compressionBenchmark                         Write the input spectra with every compression profile, log time and size\n"
+              << "  -w, -workers <N>                              Process detectors on N threads (0 = all cores)\n"
+              << "  -gg, -gammaGamma <domain>                     Calibrate the GammaGamma matrices, <domain> for summed matrices\n"
+              << "  -sh, -shards <N>                              Split the domains over N processes and merge their outputs\n"
+              << "  -merge <N>                                    Only merge the outputs of N existing shards\n"
+              << "  -runs <run,run...>                            Process several runs (numbers or files) in one process\n"
+              << "  -jobs <file>                                  Same, runs read from a file: <run or file> [save path] per line\n"
+              << "  -watch <directory>                            Calibrate every new run file of the directory until stopped\n"
+              << "  -incremental                                  Only refit the detectors whose spectrum or LUT entry changed since the last run\n"
+              << "  -resume, --resume                             Continue a run that stopped: detectors in its journal are not fitted again\n"
+              << "  -cache <directory>                            Reuse the peaks and polynomials of identical spectra from earlier runs\n"
+              << "  -cacheSize <MB>                               Size limit of the cache, least recently used entries are removed (default 512)\n";
 }
 
 std::string ArgumentsManager::getExecutableDir() const
@@ -215,6 +392,101 @@ std::string ArgumentsManager::getDataFolderPath() const
     }
 }
 
+// function to parse a comma separated list of output sinks (ex: json,peaks)
+bool ArgumentsManager::parseOutputSinks(const std::string &list)
+{
+    int sinks = 0;
+    size_t start = 0;
+    while (start <= list.size())
+    {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos)
+        {
+            end = list.size();
+        }
+        std::string sink = list.substr(start, end - start);
+        if (sink == "json")
+            sinks |= FileManager::JSON_PEAKS;
+        else if (sink == "peaks")
+            sinks |= FileManager::ROOT_PEAKS;
+        else if (sink == "calibrated")
+            sinks |= FileManager::ROOT_CALIBRATED;
+        else if (sink == "th2")
+            sinks |= FileManager::ROOT_COMBINED;
+        else if (sink == "table")
+            sinks |= FileManager::CALIBRATION_TABLE;
+        else if (sink == "gg")
+            sinks |= FileManager::ROOT_GAMMA_GAMMA;
+        else if (sink == "tree")
+            sinks |= FileManager::ROOT_PEAK_TREE;
+        else if (sink == "all")
+            sinks |= FileManager::ALL_OUTPUTS;
+        else if (!sink.empty())
+        {
+            std::cerr << "Unknown output: " << sink << '\n';
+            return false;
+        }
+        start = end + 1;
+    }
+    if (gammaGammaReferenceDomain != -1)
+    {
+        sinks |= FileManager::ROOT_GAMMA_GAMMA; // requested explicitly with -gg
+    }
+    outputSinks = sinks;
+    return true;
+}
+
+// function to parse the compression profiles of the ROOT outputs (ex: fast or th2=archive,peaks=fast)
+bool ArgumentsManager::parseCompressionProfiles(const std::string &list)
+{
+    const std::map<std::string, FileManager::OutputFile> rootOutputs = {
+        {"peaks", FileManager::ROOT_PEAKS},
+        {"calibrated", FileManager::ROOT_CALIBRATED},
+        {"th2", FileManager::ROOT_COMBINED},
+        {"gg", FileManager::ROOT_GAMMA_GAMMA},
+        {"tree", FileManager::ROOT_PEAK_TREE}};
+    size_t start = 0;
+    while (start <= list.size())
+    {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos)
+        {
+            end = list.size();
+        }
+        std::string item = list.substr(start, end - start);
+        start = end + 1;
+        if (item.empty())
+            continue;
+
+        // A profile without an output name applies to every ROOT output
+        size_t separator = item.find('=');
+        std::string output = separator == std::string::npos ? "" : item.substr(0, separator);
+        FileManager::CompressionProfile profile;
+        if (!FileManager::parseCompressionProfile(item.substr(separator + 1), profile))
+        {
+            std::cerr << "Unknown compression profile: " << item.substr(separator + 1) << " (none, fast, default, archive)\n";
+            return false;
+        }
+        if (output.empty())
+        {
+            for (const auto &rootOutput : rootOutputs)
+            {
+                compressionProfiles[rootOutput.second] = profile;
+            }
+        }
+        else if (rootOutputs.count(output))
+        {
+            compressionProfiles[rootOutputs.at(output)] = profile;
+        }
+        else
+        {
+            std::cerr << "Unknown ROOT output for compression: " << output << " (peaks, calibrated, th2, gg, tree)\n";
+            return false;
+        }
+    }
+    return true;
+}
+
 bool ArgumentsManager::isDomainLimitsSet() const
 {
     return xMinDomain != -1 && xMaxDomain != -1;
@@ -222,10 +494,10 @@ bool ArgumentsManager::isDomainLimitsSet() const
 
 int ArgumentsManager::getNumberColumnSpecified(int histogramNumber) const
 {
-    auto it = std::find(domain.begin(), domain.end(), histogramNumber);
-    if (it != domain.end())
+    auto it = domainIndex.find(histogramNumber);
+    if (it != domainIndex.end())
     {
-        return std::distance(domain.begin(), it);
+        return it->second;
     }
     else
     {
@@ -233,6 +505,18 @@ int ArgumentsManager::getNumberColumnSpecified(int histogramNumber) const
     }
 }
 
+std::vector<int> ArgumentsManager::getConfiguredDomains() const
+{
+    std::vector<int> domains;
+    domains.reserve(domainIndex.size());
+    for (const auto &entry : domainIndex)
+    {
+        domains.push_back(entry.first);
+    }
+    std::sort(domains.begin(), domains.end());
+    return domains;
+}
+
 bool ArgumentsManager::checkIfRunIsValid() const
 {
     if (inputJsonFile.empty())
@@ -292,6 +576,16 @@ void ArgumentsManager::parseJsonFile()
     nlohmann::json jsonData;
     file >> jsonData;
 
+    // The LUT can be parsed more than once, every call starts from an empty table
+    domain.clear();
+    domainIndex.clear();
+    detType.clear();
+    serial.clear();
+    ampl.clear();
+    fwhm.clear();
+    limits.clear();
+    ptLimits.clear();
+
     for (const auto& item : jsonData)
     {
         int tempDomain = item.contains("domain") ? item["domain"].get<int>() : -1;
@@ -314,7 +608,8 @@ void ArgumentsManager::parseJsonFile()
             tempPTLimits.MaxAmplitude = item["PTLimits"].contains("MaxAmplitude") ? item["PTLimits"]["MaxAmplitude"].get<int>() : static_cast<int>(MaxAmplitude);
         }
 
-        if (tempDomain != -1)
+        // The first entry of a domain is used, like the former linear search did
+        if (tempDomain != -1 && domainIndex.emplace(tempDomain, static_cast<int>(domain.size())).second)
         {
             domain.push_back(tempDomain);
             detType.push_back(tempDetType);
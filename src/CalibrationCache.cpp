@@ -0,0 +1,240 @@
+#include "../include/CalibrationCache.h"
+#include "../include/ErrorHandle.h"
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <sstream>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+    const char CACHE_MAGIC[8] = {'E', 'L', 'I', 'C', 'A', 'C', 'H', '1'};
+    const char *ENTRY_EXTENSION = ".cal";
+    const double EVICTION_TARGET = 0.9; // eviction frees a bit more than needed, so it does not run on every store
+    const uint32_t MAX_RECORDS = 1 << 16; // sanity limit for the counts read from an entry
+
+    int64_t getModificationTime(const struct stat &info)
+    {
+        return static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+    }
+
+    int64_t getCurrentTime()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    template <typename T>
+    void appendValues(std::string &data, const T *values, size_t count)
+    {
+        data.append(reinterpret_cast<const char *>(values), sizeof(T) * count);
+    }
+
+    template <typename T>
+    bool readValues(const std::string &data, size_t &offset, T *values, size_t count)
+    {
+        if (data.size() - offset < sizeof(T) * count)
+            return false;
+        std::memcpy(values, data.data() + offset, sizeof(T) * count);
+        offset += sizeof(T) * count;
+        return true;
+    }
+}
+
+CalibrationCache::CalibrationCache(const std::string &directory, uint64_t maxBytes)
+    : directory(directory), maxBytes(maxBytes), totalBytes(0), hits(0), misses(0), temporaryCounter(0)
+{
+    if (!this->directory.empty() && this->directory.back() != '/')
+    {
+        this->directory += '/';
+    }
+}
+
+std::string CalibrationCache::getEntryPath(uint64_t key) const
+{
+    std::ostringstream path;
+    path << directory << std::hex << std::setw(16) << std::setfill('0') << key << ENTRY_EXTENSION;
+    return path.str();
+}
+
+bool CalibrationCache::open()
+{
+    if (mkdir(directory.c_str(), 0777) && errno != EEXIST)
+    {
+        ErrorHandle::getInstance().logStatus("Calibration cache: could not create " + directory + ": " + strerror(errno));
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(indexMutex);
+    index.clear();
+    totalBytes = 0;
+    DIR *dir = opendir(directory.c_str());
+    if (!dir)
+    {
+        return false;
+    }
+    while (struct dirent *ent = readdir(dir))
+    {
+        std::string name = ent->d_name;
+        if (name.size() != 16 + std::strlen(ENTRY_EXTENSION) || name.compare(16, std::string::npos, ENTRY_EXTENSION) != 0)
+            continue;
+        // Other files of a shared directory can have the same shape, only hex keys are entries
+        uint64_t key = 0;
+        std::from_chars_result parsed = std::from_chars(name.data(), name.data() + 16, key, 16);
+        if (parsed.ec != std::errc() || parsed.ptr != name.data() + 16)
+            continue;
+        struct stat info;
+        if (stat((directory + name).c_str(), &info) != 0)
+            continue;
+        index[key] = {static_cast<uint64_t>(info.st_size), getModificationTime(info)};
+        totalBytes += info.st_size;
+    }
+    closedir(dir);
+    ErrorHandle::getInstance().logStatus("Calibration cache: " + std::to_string(index.size()) + " entries, " +
+                                         std::to_string(totalBytes >> 10) + " KiB in " + directory);
+    evictLocked();
+    return true;
+}
+
+std::string CalibrationCache::serialize(const Result &result)
+{
+    // uint32 peakMatchCount, uint32 n, double coefficients[n], uint32 m, PeakRecord peaks[m]
+    std::string data;
+    uint32_t numberOfCoefficients = result.coefficients.size();
+    uint32_t numberOfPeaks = result.peaks.size();
+    appendValues(data, &result.peakMatchCount, 1);
+    appendValues(data, &numberOfCoefficients, 1);
+    appendValues(data, result.coefficients.data(), numberOfCoefficients);
+    appendValues(data, &numberOfPeaks, 1);
+    appendValues(data, result.peaks.data(), numberOfPeaks);
+    return data;
+}
+
+bool CalibrationCache::deserialize(const std::string &data, Result &result)
+{
+    size_t offset = 0;
+    uint32_t numberOfCoefficients = 0;
+    uint32_t numberOfPeaks = 0;
+    if (!readValues(data, offset, &result.peakMatchCount, 1) || !readValues(data, offset, &numberOfCoefficients, 1) ||
+        numberOfCoefficients >= MAX_RECORDS)
+        return false;
+    result.coefficients.resize(numberOfCoefficients);
+    if (!readValues(data, offset, result.coefficients.data(), numberOfCoefficients) ||
+        !readValues(data, offset, &numberOfPeaks, 1) || numberOfPeaks >= MAX_RECORDS)
+        return false;
+    result.peaks.resize(numberOfPeaks);
+    return readValues(data, offset, result.peaks.data(), numberOfPeaks) && offset == data.size();
+}
+
+bool CalibrationCache::lookup(uint64_t key, Result &result)
+{
+    std::string path = getEntryPath(key);
+    std::ifstream file(path, std::ios::binary);
+    std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    size_t headerSize = sizeof(CACHE_MAGIC) + sizeof(uint64_t);
+    bool valid = data.size() >= headerSize && std::memcmp(data.data(), CACHE_MAGIC, sizeof(CACHE_MAGIC)) == 0 &&
+                 std::memcmp(data.data() + sizeof(CACHE_MAGIC), &key, sizeof(uint64_t)) == 0 &&
+                 deserialize(data.substr(headerSize), result);
+    if (!valid)
+    {
+        ++misses;
+        return false;
+    }
+
+    // The modification time is the last use of the entry
+    utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+    {
+        std::lock_guard<std::mutex> lock(indexMutex);
+        auto it = index.find(key);
+        if (it != index.end())
+        {
+            it->second.lastUse = getCurrentTime();
+        }
+    }
+    ++hits;
+    return true;
+}
+
+void CalibrationCache::store(uint64_t key, const Result &result)
+{
+    std::string path = getEntryPath(key);
+    std::string temporaryPath = path + ".tmp" + std::to_string(getpid()) + "_" + std::to_string(temporaryCounter++);
+    std::string data = serialize(result);
+    {
+        std::ofstream file(temporaryPath, std::ios::binary);
+        if (!file.is_open())
+        {
+            return;
+        }
+        file.write(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+        file.write(reinterpret_cast<const char *>(&key), sizeof(uint64_t));
+        file << data;
+        if (!file.good())
+        {
+            file.close();
+            std::remove(temporaryPath.c_str());
+            return;
+        }
+    }
+    if (std::rename(temporaryPath.c_str(), path.c_str()) != 0)
+    {
+        std::remove(temporaryPath.c_str());
+        return;
+    }
+
+    uint64_t size = sizeof(CACHE_MAGIC) + sizeof(uint64_t) + data.size();
+    std::lock_guard<std::mutex> lock(indexMutex);
+    auto it = index.find(key);
+    if (it != index.end())
+    {
+        totalBytes -= it->second.size;
+    }
+    index[key] = {size, getCurrentTime()};
+    totalBytes += size;
+    if (totalBytes > maxBytes)
+    {
+        evictLocked();
+    }
+}
+
+void CalibrationCache::evictLocked()
+{
+    if (totalBytes <= maxBytes)
+        return;
+
+    // Least recently used first, until the directory is back under the limit
+    std::vector<std::pair<int64_t, uint64_t>> entries; // last use, key
+    entries.reserve(index.size());
+    for (const auto &entry : index)
+    {
+        entries.emplace_back(entry.second.lastUse, entry.first);
+    }
+    std::sort(entries.begin(), entries.end());
+
+    uint64_t target = static_cast<uint64_t>(maxBytes * EVICTION_TARGET);
+    int removed = 0;
+    for (const auto &entry : entries)
+    {
+        if (totalBytes <= target)
+            break;
+        std::remove(getEntryPath(entry.second).c_str());
+        totalBytes -= index[entry.second].size;
+        index.erase(entry.second);
+        ++removed;
+    }
+    ErrorHandle::getInstance().logStatus("Calibration cache: " + std::to_string(removed) + " least recently used entries evicted.");
+}
+
+uint64_t CalibrationCache::getTotalBytes() const
+{
+    // store() changes it from the fit workers
+    std::lock_guard<std::mutex> lock(indexMutex);
+    return totalBytes;
+}
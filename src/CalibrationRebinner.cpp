@@ -0,0 +1,177 @@
+#include "../include/CalibrationRebinner.h"
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+CalibrationRebinner::CalibrationRebinner(const std::vector<double> &coefficients,
+                                         int sourceBins, double sourceMin, double sourceMax,
+                                         int destinationBins, double destinationMin, double destinationMax)
+    : sourceBins(sourceBins), destinationBins(destinationBins),
+      destinationMin(destinationMin), destinationMax(destinationMax),
+      destinationWidth((destinationMax - destinationMin) / destinationBins), finiteEdges(true)
+{
+    buildEdgeTable(coefficients, sourceMin, sourceMax);
+}
+
+double CalibrationRebinner::evaluatePolynomial(const std::vector<double> &coefficients, double x)
+{
+    // Horner scheme, coefficients are stored from the constant term upwards
+    double value = 0;
+    for (size_t i = coefficients.size(); i-- > 0;)
+    {
+        value = value * x + coefficients[i];
+    }
+    return value;
+}
+
+void CalibrationRebinner::buildEdgeTable(const std::vector<double> &coefficients, double sourceMin, double sourceMax)
+{
+    calibratedEdges.resize(sourceBins + 1);
+    double sourceWidth = (sourceMax - sourceMin) / sourceBins;
+    for (int edge = 0; edge <= sourceBins; ++edge)
+    {
+        calibratedEdges[edge] = evaluatePolynomial(coefficients, sourceMin + edge * sourceWidth);
+        finiteEdges = finiteEdges && std::isfinite(calibratedEdges[edge]);
+    }
+}
+
+int CalibrationRebinner::findDestinationBin(double value) const
+{
+    // Clamped as a double, a NaN or far out value from a failed fit must never reach the int conversion
+    double position = (value - destinationMin) / destinationWidth + 1;
+    if (std::isnan(position))
+        return 1;
+    position = std::clamp(position, 1.0, static_cast<double>(destinationBins));
+    return static_cast<int>(position);
+}
+
+double CalibrationRebinner::getDestinationLowEdge(int bin) const
+{
+    return destinationMin + (bin - 1) * destinationWidth;
+}
+
+template <typename AddFunction>
+void CalibrationRebinner::distributeBin(int bin, double counts, AddFunction add) const
+{
+    // Underflow and overflow stay outside the axis, a decreasing calibration swaps them
+    bool increasing = calibratedEdges.back() >= calibratedEdges.front();
+    if (bin == 0 || bin == sourceBins + 1)
+    {
+        add((bin == 0) == increasing ? 0 : destinationBins + 1, counts);
+        return;
+    }
+
+    double low = calibratedEdges[bin - 1];
+    double high = calibratedEdges[bin];
+    if (low > high)
+        std::swap(low, high);
+
+    if (high <= destinationMin)
+    {
+        add(0, counts);
+        return;
+    }
+    if (low >= destinationMax)
+    {
+        add(destinationBins + 1, counts);
+        return;
+    }
+    if (high == low)
+    {
+        add(findDestinationBin(low), counts);
+        return;
+    }
+
+    // Split the counts proportionally to the overlap, the last piece takes the
+    // remainder so the bin is conserved exactly
+    double width = high - low;
+    double remaining = counts;
+    if (low < destinationMin)
+    {
+        double part = counts * (destinationMin - low) / width;
+        add(0, part);
+        remaining -= part;
+        low = destinationMin;
+    }
+
+    int destinationBin = findDestinationBin(low);
+    for (; destinationBin <= destinationBins; ++destinationBin)
+    {
+        double upEdge = getDestinationLowEdge(destinationBin + 1);
+        if (upEdge >= high)
+        {
+            add(destinationBin, remaining);
+            return;
+        }
+        if (upEdge <= low)
+            continue;
+
+        double part = counts * (upEdge - low) / width;
+        add(destinationBin, part);
+        remaining -= part;
+        low = upEdge;
+    }
+    add(destinationBins + 1, remaining);
+}
+
+template <typename SourceT, typename DestinationT>
+void CalibrationRebinner::rebin(const SourceT *source, DestinationT *destination, int firstBin, int lastBin) const
+{
+    if (!finiteEdges)
+        return;
+    auto add = [destination](int destinationBin, double counts)
+    { destination[destinationBin] += counts; };
+    auto distribute = [&](int bin)
+    {
+        double counts = static_cast<double>(source[bin]);
+        if (counts != 0)
+        {
+            distributeBin(bin, counts, add);
+        }
+    };
+
+    firstBin = std::max(firstBin, 1);
+    lastBin = (lastBin < 0) ? sourceBins : std::min(lastBin, sourceBins);
+    distribute(0);
+    for (int bin = firstBin; bin <= lastBin; ++bin)
+    {
+        distribute(bin);
+    }
+    distribute(sourceBins + 1);
+}
+
+template <typename SourceT, typename DestinationT>
+void CalibrationRebinner::rebin2D(const CalibrationRebinner &xRebinner, const SourceT *source, DestinationT *destination) const
+{
+    if (!finiteEdges || !xRebinner.finiteEdges)
+        return;
+    int sourceCellsX = xRebinner.sourceBins + 2;
+    int destinationCellsX = xRebinner.destinationBins + 2;
+    std::vector<double> calibratedRow(destinationCellsX);
+
+    // One pass over the source rows: each row is remapped along x into a scratch row,
+    // which is then spread over the (monotonic, so neighbouring) destination rows it overlaps.
+    // The working set is one source row, the scratch row and the few destination rows it touches.
+    for (int row = 0; row <= sourceBins + 1; ++row)
+    {
+        const SourceT *sourceRow = source + static_cast<size_t>(row) * sourceCellsX;
+        std::fill(calibratedRow.begin(), calibratedRow.end(), 0.0);
+        xRebinner.rebin(sourceRow, calibratedRow.data());
+
+        distributeBin(row, 1.0, [&](int destinationRow, double fraction)
+                      {
+                          if (fraction == 0)
+                              return;
+                          DestinationT *target = destination + static_cast<size_t>(destinationRow) * destinationCellsX;
+                          for (int x = 0; x < destinationCellsX; ++x)
+                          {
+                              target[x] += calibratedRow[x] * fraction;
+                          }
+                      });
+    }
+}
+
+template void CalibrationRebinner::rebin<double, double>(const double *source, double *destination, int firstBin, int lastBin) const;
+template void CalibrationRebinner::rebin<double, float>(const double *source, float *destination, int firstBin, int lastBin) const;
+template void CalibrationRebinner::rebin<float, double>(const float *source, double *destination, int firstBin, int lastBin) const;
+template void CalibrationRebinner::rebin2D<float, float>(const CalibrationRebinner &xRebinner, const float *source, float *destination) const;
@@ -0,0 +1,285 @@
+#include "../include/CalibrationTable.h"
+#include "../include/CalibrationRebinner.h"
+#include <fstream>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <cstring>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    constexpr char FILE_MAGIC[8] = {'E', 'L', 'I', 'C', 'A', 'L', 'T', '1'};
+    constexpr double INVALID_VALUE = std::numeric_limits<double>::quiet_NaN();
+    // Limits of the header values accepted by readFromFile(), far above any real setup
+    constexpr int MAX_CHANNELS = 1 << 24;
+    constexpr int MAX_DOMAIN = 1 << 20;
+    constexpr int MAX_COEFFICIENTS = 64;
+}
+
+CalibrationTable::CalibrationTable() : CalibrationTable(0, 0)
+{
+}
+
+CalibrationTable::CalibrationTable(int numberOfChannels, int firstChannel)
+    : numberOfChannels(numberOfChannels), firstChannel(firstChannel),
+      numberOfEnergyBins(0)
+{
+}
+
+void CalibrationTable::addDetector(int domain, const std::vector<double> &coefficients)
+{
+    if (domain < 0 || coefficients.empty())
+    {
+        return;
+    }
+    detectors.push_back({domain, coefficients, 0, -1, 0, 0});
+}
+
+bool CalibrationTable::hasDomain(int domain) const
+{
+    return domain >= 0 && domain < static_cast<int>(domainOffsets.size()) && domainOffsets[domain] >= 0;
+}
+
+void CalibrationTable::build()
+{
+    int maxDomain = -1;
+    for (const auto &detector : detectors)
+    {
+        maxDomain = std::max(maxDomain, detector.domain);
+    }
+    domainOffsets.assign(maxDomain + 1, -1);
+    energyTable.assign(static_cast<size_t>(detectors.size()) * numberOfChannels, 0.0);
+
+    // Forward table, one polynomial evaluation per channel
+    for (size_t slot = 0; slot < detectors.size(); ++slot)
+    {
+        domainOffsets[detectors[slot].domain] = static_cast<int>(slot) * numberOfChannels;
+        double *table = &energyTable[slot * numberOfChannels];
+        for (int channel = 0; channel < numberOfChannels; ++channel)
+        {
+            table[channel] = CalibrationRebinner::evaluatePolynomial(detectors[slot].coefficients, firstChannel + channel);
+        }
+    }
+
+    // Every inverse table has as many grid points as there are channels, spread over its own range
+    numberOfEnergyBins = detectors.empty() ? 0 : numberOfChannels;
+    channelTable.assign(static_cast<size_t>(detectors.size()) * numberOfEnergyBins, INVALID_VALUE);
+    for (size_t slot = 0; slot < detectors.size(); ++slot)
+    {
+        buildInverseTable(slot);
+    }
+}
+
+void CalibrationTable::buildInverseTable(int slot)
+{
+    Detector &detector = detectors[slot];
+    const double *table = &energyTable[static_cast<size_t>(slot) * numberOfChannels];
+    double *inverse = &channelTable[static_cast<size_t>(slot) * numberOfEnergyBins];
+    detector.inverseFirst = 0;
+    detector.inverseLast = -1;
+    detector.energyMin = 0;
+    detector.energyStep = 0;
+    if (numberOfChannels < 2)
+    {
+        return;
+    }
+
+    // Only the monotonic increasing part of the calibration can be inverted
+    int lastMonotonic = 0;
+    while (lastMonotonic + 1 < numberOfChannels && table[lastMonotonic + 1] > table[lastMonotonic])
+    {
+        ++lastMonotonic;
+    }
+    if (lastMonotonic == 0 || !std::isfinite(table[0]) || !std::isfinite(table[lastMonotonic]))
+    {
+        return;
+    }
+
+    // The grid covers exactly the monotonic range, a wild polynomial of another detector does not matter
+    detector.energyMin = table[0];
+    detector.energyStep = (table[lastMonotonic] - table[0]) / (numberOfEnergyBins - 1);
+    detector.inverseFirst = 0;
+    detector.inverseLast = numberOfEnergyBins - 1;
+
+    int channel = 0;
+    for (int point = detector.inverseFirst; point <= detector.inverseLast; ++point)
+    {
+        double energy = point == detector.inverseLast ? table[lastMonotonic] : detector.energyMin + point * detector.energyStep;
+        while (channel + 1 < lastMonotonic && table[channel + 1] < energy)
+        {
+            ++channel;
+        }
+        double fraction = (energy - table[channel]) / (table[channel + 1] - table[channel]);
+        inverse[point] = firstChannel + channel + fraction;
+    }
+}
+
+double CalibrationTable::channelToEnergy(int domain, int channel) const
+{
+    int index = channel - firstChannel;
+    if (!hasDomain(domain) || index < 0 || index >= numberOfChannels)
+    {
+        return INVALID_VALUE;
+    }
+    return energyTable[domainOffsets[domain] + index];
+}
+
+double CalibrationTable::energyToChannel(int domain, double energy) const
+{
+    if (!hasDomain(domain))
+    {
+        return INVALID_VALUE;
+    }
+    int slot = domainOffsets[domain] / numberOfChannels;
+    const Detector &detector = detectors[slot];
+    if (detector.energyStep <= 0)
+    {
+        return INVALID_VALUE;
+    }
+    double position = (energy - detector.energyMin) / detector.energyStep;
+    if (!(position >= detector.inverseFirst && position < detector.inverseLast + 1))
+    {
+        return INVALID_VALUE;
+    }
+    int point = static_cast<int>(position);
+
+    const double *inverse = &channelTable[static_cast<size_t>(slot) * numberOfEnergyBins];
+    if (point == detector.inverseLast)
+    {
+        return position == point ? inverse[point] : INVALID_VALUE;
+    }
+    double fraction = position - point;
+    return inverse[point] + fraction * (inverse[point + 1] - inverse[point]);
+}
+
+void CalibrationTable::convertToEnergy(const int *domains, const int *channels, double *energies, size_t count) const
+{
+    size_t i = 0;
+#ifdef __AVX2__
+    if (!domainOffsets.empty())
+    {
+        const __m256i minusOne = _mm256_set1_epi32(-1);
+        const __m256i domainLimit = _mm256_set1_epi32(static_cast<int>(domainOffsets.size()));
+        const __m256i channelLimit = _mm256_set1_epi32(numberOfChannels);
+        const __m256i channelStart = _mm256_set1_epi32(firstChannel);
+        const __m256d invalid = _mm256_set1_pd(INVALID_VALUE);
+
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256i domain = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(domains + i));
+            __m256i channel = _mm256_sub_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(channels + i)), channelStart);
+
+            // domain -> table offset, out of range domains keep -1
+            __m256i domainValid = _mm256_and_si256(_mm256_cmpgt_epi32(domainLimit, domain), _mm256_cmpgt_epi32(domain, minusOne));
+            __m256i offset = _mm256_mask_i32gather_epi32(minusOne, domainOffsets.data(), domain, domainValid, 4);
+
+            __m256i valid = _mm256_and_si256(_mm256_cmpgt_epi32(offset, minusOne),
+                                             _mm256_and_si256(_mm256_cmpgt_epi32(channelLimit, channel), _mm256_cmpgt_epi32(channel, minusOne)));
+            __m256i index = _mm256_add_epi32(offset, channel);
+
+            __m256d maskLow = _mm256_castsi256_pd(_mm256_cvtepi32_epi64(_mm256_castsi256_si128(valid)));
+            __m256d maskHigh = _mm256_castsi256_pd(_mm256_cvtepi32_epi64(_mm256_extracti128_si256(valid, 1)));
+            __m256d low = _mm256_mask_i32gather_pd(invalid, energyTable.data(), _mm256_castsi256_si128(index), maskLow, 8);
+            __m256d high = _mm256_mask_i32gather_pd(invalid, energyTable.data(), _mm256_extracti128_si256(index, 1), maskHigh, 8);
+            _mm256_storeu_pd(energies + i, low);
+            _mm256_storeu_pd(energies + i + 4, high);
+        }
+    }
+#endif
+    for (; i < count; ++i)
+    {
+        energies[i] = channelToEnergy(domains[i], channels[i]);
+    }
+}
+
+void CalibrationTable::convertToChannel(const int *domains, const double *energies, double *channels, size_t count) const
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        channels[i] = energyToChannel(domains[i], energies[i]);
+    }
+}
+
+bool CalibrationTable::writeToFile(const std::string &path) const
+{
+    std::ofstream file(path, std::ios::binary);
+    if (!file.is_open())
+    {
+        return false;
+    }
+
+    int numberOfDetectors = detectors.size();
+    file.write(FILE_MAGIC, sizeof(FILE_MAGIC));
+    file.write(reinterpret_cast<const char *>(&numberOfChannels), sizeof(int));
+    file.write(reinterpret_cast<const char *>(&firstChannel), sizeof(int));
+    file.write(reinterpret_cast<const char *>(&numberOfDetectors), sizeof(int));
+    for (const auto &detector : detectors)
+    {
+        int numberOfCoefficients = detector.coefficients.size();
+        file.write(reinterpret_cast<const char *>(&detector.domain), sizeof(int));
+        file.write(reinterpret_cast<const char *>(&numberOfCoefficients), sizeof(int));
+        file.write(reinterpret_cast<const char *>(detector.coefficients.data()), numberOfCoefficients * sizeof(double));
+    }
+    return file.good();
+}
+
+bool CalibrationTable::readFromFile(const std::string &path, bool append)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open())
+    {
+        return false;
+    }
+
+    char magic[sizeof(FILE_MAGIC)];
+    int fileChannels = 0;
+    int fileFirstChannel = 0;
+    int numberOfDetectors = 0;
+    file.read(magic, sizeof(magic));
+    if (!file || std::memcmp(magic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0)
+    {
+        return false;
+    }
+    file.read(reinterpret_cast<char *>(&fileChannels), sizeof(int));
+    file.read(reinterpret_cast<char *>(&fileFirstChannel), sizeof(int));
+    file.read(reinterpret_cast<char *>(&numberOfDetectors), sizeof(int));
+    if (!file || fileChannels <= 0 || fileChannels > MAX_CHANNELS ||
+        numberOfDetectors < 0 || numberOfDetectors > MAX_DOMAIN + 1)
+    {
+        return false;
+    }
+
+    // Nothing of a corrupt file is kept, the detectors are only taken over once all of them are read
+    std::vector<Detector> fileDetectors;
+    for (int i = 0; i < numberOfDetectors; ++i)
+    {
+        int domain = 0;
+        int numberOfCoefficients = 0;
+        file.read(reinterpret_cast<char *>(&domain), sizeof(int));
+        file.read(reinterpret_cast<char *>(&numberOfCoefficients), sizeof(int));
+        if (!file || domain < 0 || domain > MAX_DOMAIN || numberOfCoefficients <= 0 || numberOfCoefficients > MAX_COEFFICIENTS)
+        {
+            return false;
+        }
+        std::vector<double> coefficients(numberOfCoefficients);
+        file.read(reinterpret_cast<char *>(coefficients.data()), coefficients.size() * sizeof(double));
+        fileDetectors.push_back({domain, coefficients, 0, -1, 0, 0});
+    }
+    if (!file)
+    {
+        return false;
+    }
+
+    numberOfChannels = fileChannels;
+    firstChannel = fileFirstChannel;
+    if (!append)
+    {
+        detectors.clear();
+    }
+    detectors.insert(detectors.end(), fileDetectors.begin(), fileDetectors.end());
+    build();
+    return true;
+}
@@ -0,0 +1,127 @@
+#include "../include/CheckpointJournal.h"
+#include "../include/RunManifest.h"
+#include "../include/ErrorHandle.h"
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+namespace
+{
+    const char JOURNAL_MAGIC[8] = {'E', 'L', 'I', 'J', 'R', 'N', 'L', '1'};
+    const uint32_t MAX_RECORD_SIZE = 1 << 24;
+
+    template <typename T>
+    bool readValue(std::ifstream &file, T &value)
+    {
+        return static_cast<bool>(file.read(reinterpret_cast<char *>(&value), sizeof(T)));
+    }
+
+    template <typename T>
+    void writeValue(std::ofstream &file, const T &value)
+    {
+        file.write(reinterpret_cast<const char *>(&value), sizeof(T));
+    }
+}
+
+bool CheckpointJournal::open(const std::string &journalPath, uint64_t settingsHash, bool resume)
+{
+    path = journalPath;
+    finished.clear();
+    if (file.is_open())
+    {
+        file.close();
+    }
+
+    if (resume && readExisting(settingsHash))
+    {
+        // The valid records are kept, new ones are appended after them
+        file.open(path, std::ios::binary | std::ios::app);
+        ErrorHandle::getInstance().logStatus("Resume: " + std::to_string(finished.size()) + " finished detectors found in " + path);
+    }
+    else
+    {
+        if (resume)
+        {
+            ErrorHandle::getInstance().logStatus("Resume: no usable journal in " + path + ", all detectors are processed.");
+        }
+        finished.clear();
+        file.open(path, std::ios::binary | std::ios::trunc);
+        file.write(JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+        writeValue(file, settingsHash);
+        file.flush();
+    }
+    if (!file.is_open())
+    {
+        ErrorHandle::getInstance().logStatus("Error: Could not open the checkpoint journal " + path);
+        return false;
+    }
+    return true;
+}
+
+bool CheckpointJournal::readExisting(uint64_t settingsHash)
+{
+    std::ifstream input(path, std::ios::binary);
+    char magic[8];
+    uint64_t storedSettings = 0;
+    if (!input.read(magic, sizeof(magic)) || std::memcmp(magic, JOURNAL_MAGIC, sizeof(magic)) != 0 ||
+        !readValue(input, storedSettings) || storedSettings != settingsHash)
+    {
+        return false;
+    }
+
+    std::streamoff validEnd = input.tellg();
+    int32_t domain = 0;
+    uint64_t inputHash = 0;
+    uint32_t size = 0;
+    uint64_t checksum = 0;
+    while (readValue(input, domain) && readValue(input, inputHash) && readValue(input, size) && size < MAX_RECORD_SIZE)
+    {
+        std::string data(size, '\0');
+        CalibrationCache::Result result;
+        if (!input.read(&data[0], size) || !readValue(input, checksum) ||
+            checksum != RunManifest::hashString(data) || !CalibrationCache::deserialize(data, result))
+        {
+            break;
+        }
+        finished[domain] = {inputHash, result};
+        validEnd = input.tellg();
+    }
+    input.close();
+
+    // A record cut by the crash is dropped, so appended records follow the last valid one
+    if (truncate(path.c_str(), validEnd) != 0)
+    {
+        return false;
+    }
+    return true;
+}
+
+void CheckpointJournal::append(int domain, uint64_t inputHash, const CalibrationCache::Result &result)
+{
+    std::string data = CalibrationCache::serialize(result);
+    std::lock_guard<std::mutex> lock(fileMutex);
+    if (!file.is_open())
+        return;
+    writeValue(file, static_cast<int32_t>(domain));
+    writeValue(file, inputHash);
+    writeValue(file, static_cast<uint32_t>(data.size()));
+    file << data;
+    writeValue(file, RunManifest::hashString(data));
+    file.flush(); // in the kernel before the next detector, survives a crash of this process
+}
+
+const CalibrationCache::Result *CheckpointJournal::find(int domain, uint64_t inputHash) const
+{
+    auto it = finished.find(domain);
+    return (it != finished.end() && it->second.first == inputHash) ? &it->second.second : nullptr;
+}
+
+void CheckpointJournal::remove()
+{
+    if (file.is_open())
+    {
+        file.close();
+        std::remove(path.c_str());
+    }
+    finished.clear();
+}
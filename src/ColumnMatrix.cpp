@@ -0,0 +1,161 @@
+#include "../include/ColumnMatrix.h"
+#include "../include/RawSpectraFile.h"
+#include "../include/ListModeSpectra.h"
+#include <algorithm>
+
+ColumnMatrix::ColumnMatrix()
+    : mappedValues(nullptr), columnSize(0), numberOfChannels(0), channelMin(0), channelMax(0)
+{
+}
+
+void ColumnMatrix::load(const TH2F &histogram, const std::vector<int> &columns)
+{
+    int cellsX = histogram.GetNbinsX() + 2;
+    const TAxis *channelAxis = histogram.GetYaxis();
+    numberOfChannels = histogram.GetNbinsY();
+    columnSize = numberOfChannels + 2;
+    channelMin = channelAxis->GetXmin();
+    channelMax = channelAxis->GetXmax();
+    title = histogram.GetTitle();
+    channelEdges.clear();
+    mappedValues = nullptr;
+    if (channelAxis->IsVariableBinSize())
+    {
+        const TArrayD *edges = channelAxis->GetXbins();
+        channelEdges.assign(edges->GetArray(), edges->GetArray() + edges->GetSize());
+    }
+
+    slots.assign(cellsX, -1);
+    std::vector<int> storedColumns;
+    for (int column : columns)
+    {
+        if (column >= 0 && column < cellsX && slots[column] < 0)
+        {
+            slots[column] = storedColumns.size();
+            storedColumns.push_back(column);
+        }
+    }
+    values.assign(storedColumns.size() * static_cast<size_t>(columnSize), 0.0f);
+
+    // Blocked transpose: the rows of one block stay in cache while all columns read from them
+    constexpr int BLOCK = 64;
+    const float *cells = histogram.GetArray();
+    for (int yBlock = 0; yBlock < columnSize; yBlock += BLOCK)
+    {
+        int yEnd = std::min(yBlock + BLOCK, columnSize);
+        for (size_t slot = 0; slot < storedColumns.size(); ++slot)
+        {
+            float *target = &values[slot * columnSize];
+            const float *source = cells + storedColumns[slot];
+            for (int y = yBlock; y < yEnd; ++y)
+            {
+                target[y] = source[static_cast<size_t>(cellsX) * y];
+            }
+        }
+    }
+}
+
+void ColumnMatrix::load(const RawSpectraFile &spectra, const std::vector<int> &columns)
+{
+    int cellsX = spectra.getNumberOfColumns() + 2;
+    numberOfChannels = spectra.getNumberOfChannels();
+    columnSize = spectra.getColumnSize();
+    channelMin = spectra.getChannelMin();
+    channelMax = spectra.getChannelMax();
+    title.clear();
+    channelEdges.clear();
+    values.clear();
+
+    slots.assign(cellsX, -1);
+    if (spectra.isZeroCopy())
+    {
+        // Every column keeps its position in the file, the spans are read from the page cache
+        mappedValues = spectra.getColumn(0);
+        for (int column : columns)
+        {
+            if (column >= 0 && column < cellsX)
+            {
+                slots[column] = column;
+            }
+        }
+        return;
+    }
+
+    mappedValues = nullptr;
+    std::vector<int> storedColumns;
+    for (int column : columns)
+    {
+        if (column >= 0 && column < cellsX && slots[column] < 0)
+        {
+            slots[column] = storedColumns.size();
+            storedColumns.push_back(column);
+        }
+    }
+    values.assign(storedColumns.size() * static_cast<size_t>(columnSize), 0.0f);
+    for (size_t slot = 0; slot < storedColumns.size(); ++slot)
+    {
+        spectra.copyColumn(storedColumns[slot], &values[slot * columnSize]);
+    }
+}
+
+void ColumnMatrix::load(const ListModeSpectra &spectra, const std::vector<int> &columns)
+{
+    numberOfChannels = spectra.getNumberOfChannels();
+    columnSize = spectra.getColumnSize();
+    channelMin = spectra.getChannelMin();
+    channelMax = spectra.getChannelMax();
+    title.clear();
+    channelEdges.clear();
+    values.clear();
+
+    // The spectra already hold one span per LUT detector, the slots point at them
+    mappedValues = spectra.getValues();
+    slots.assign(spectra.getNumberOfColumns() + 2, -1);
+    for (int column : columns)
+    {
+        if (column >= 0 && column < static_cast<int>(slots.size()))
+        {
+            slots[column] = spectra.getSlot(column);
+        }
+    }
+}
+
+void ColumnMatrix::release()
+{
+    std::vector<float>().swap(values);
+    slots.clear();
+    mappedValues = nullptr;
+}
+
+bool ColumnMatrix::hasColumn(int column) const
+{
+    return column >= 0 && column < static_cast<int>(slots.size()) && slots[column] >= 0;
+}
+
+ColumnMatrix::Span ColumnMatrix::getColumn(int column) const
+{
+    Span span;
+    if (hasColumn(column))
+    {
+        span.data = (mappedValues ? mappedValues : values.data()) + static_cast<size_t>(slots[column]) * columnSize;
+        span.size = columnSize;
+    }
+    return span;
+}
+
+std::unique_ptr<TH1D> ColumnMatrix::createHistogram(int column, const std::string &name) const
+{
+    Span span = getColumn(column);
+    if (span.empty())
+    {
+        return nullptr;
+    }
+
+    std::unique_ptr<TH1D> histogram(channelEdges.empty()
+                                        ? new TH1D(name.c_str(), title.c_str(), numberOfChannels, channelMin, channelMax)
+                                        : new TH1D(name.c_str(), title.c_str(), numberOfChannels, channelEdges.data()));
+    histogram->SetDirectory(nullptr);
+    std::copy(span.data, span.data + span.size, histogram->GetArray());
+    histogram->ResetStats();
+    return histogram;
+}
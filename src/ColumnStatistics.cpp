@@ -0,0 +1,124 @@
+#include "../include/ColumnStatistics.h"
+#include "../include/RunManifest.h"
+#include "../include/RawSpectraFile.h"
+#include "../include/ListModeSpectra.h"
+#include <algorithm>
+
+namespace
+{
+    // Statistics of spectra stored as one span per column (TH1 layout, uniform channel bins)
+    template <typename Spectra, typename GetColumn>
+    std::vector<ColumnStatistics> collectSpans(const Spectra &spectra, const std::vector<int> &columns, GetColumn getColumn)
+    {
+        int cellsX = spectra.getNumberOfColumns() + 2;
+        int numberOfChannels = spectra.getNumberOfChannels();
+        double channelWidth = (spectra.getChannelMax() - spectra.getChannelMin()) / numberOfChannels;
+        std::vector<ColumnStatistics> statistics(cellsX);
+        for (int column : columns)
+        {
+            if (column < 0 || column >= cellsX)
+                continue;
+            const float *counts = getColumn(column);
+            if (!counts)
+                continue;
+
+            // Same cells in the same order as the TH2F pass, so the content hash is the same
+            ColumnStatistics &columnStatistics = statistics[column];
+            columnStatistics.contentHash = RunManifest::HASH_SEED;
+            double weightedSum = 0;
+            for (int channel = 0; channel <= numberOfChannels + 1; ++channel)
+            {
+                if (counts[channel] != 0)
+                {
+                    double center = spectra.getChannelMin() + (channel - 0.5) * channelWidth;
+                    columnStatistics.addCell(channel, counts[channel], center, channel >= 1 && channel <= numberOfChannels, weightedSum);
+                }
+            }
+            if (columnStatistics.integral != 0)
+            {
+                columnStatistics.mean = weightedSum / columnStatistics.integral;
+            }
+        }
+        return statistics;
+    }
+}
+
+std::vector<ColumnStatistics> ColumnStatistics::collect(const TH2F &histogram, const std::vector<int> &columns)
+{
+    int cellsX = histogram.GetNbinsX() + 2;
+    int numberOfChannels = histogram.GetNbinsY();
+    std::vector<ColumnStatistics> statistics(cellsX);
+    std::vector<int> validColumns;
+    for (int column : columns)
+    {
+        if (column >= 0 && column < cellsX)
+        {
+            validColumns.push_back(column);
+        }
+    }
+
+    const float *cells = histogram.GetArray();
+    const TAxis *channelAxis = histogram.GetYaxis();
+    std::vector<double> weightedSums(cellsX, 0);
+    for (int column : validColumns)
+    {
+        statistics[column].contentHash = RunManifest::HASH_SEED;
+    }
+    for (int channel = 0; channel <= numberOfChannels + 1; ++channel)
+    {
+        const float *row = cells + static_cast<size_t>(channel) * cellsX;
+        double center = channelAxis->GetBinCenter(channel);
+        bool regularBin = channel >= 1 && channel <= numberOfChannels;
+        for (int column : validColumns)
+        {
+            float content = row[column];
+            if (content != 0)
+            {
+                statistics[column].addCell(channel, content, center, regularBin, weightedSums[column]);
+            }
+        }
+    }
+
+    for (int column : validColumns)
+    {
+        if (statistics[column].integral != 0)
+        {
+            statistics[column].mean = weightedSums[column] / statistics[column].integral;
+        }
+    }
+    return statistics;
+}
+
+std::vector<ColumnStatistics> ColumnStatistics::collect(const RawSpectraFile &spectra, const std::vector<int> &columns)
+{
+    std::vector<float> buffer; // only for counts that are not float32
+    return collectSpans(spectra, columns, [&](int column)
+                        {
+        const float *counts = spectra.getColumn(column);
+        if (!counts)
+        {
+            buffer.resize(spectra.getColumnSize());
+            spectra.copyColumn(column, buffer.data());
+            counts = buffer.data();
+        }
+        return counts; });
+}
+
+std::vector<ColumnStatistics> ColumnStatistics::collect(const ListModeSpectra &spectra, const std::vector<int> &columns)
+{
+    return collectSpans(spectra, columns, [&](int column)
+                        { return spectra.getColumn(column); });
+}
+
+void ColumnStatistics::addCell(int channel, float content, double center, bool regularBin, double &weightedSum)
+{
+    contentHash = RunManifest::hashValue(content, RunManifest::hashValue(channel, contentHash));
+    if (!regularBin)
+        return;
+    integral += content;
+    max = std::max(max, content);
+    if (firstBin == 0)
+        firstBin = channel;
+    lastBin = channel;
+    weightedSum += content * center;
+}
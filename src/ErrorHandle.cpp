@@ -1,4 +1,5 @@
 #include "../include/ErrorHandle.h"
+#include "../include/JsonWriter.h"
 #include <iostream>
 #include <fstream>
 #include <sstream>
@@ -114,6 +115,7 @@ void ErrorHandle::errorHandle(int errorNumber)
 
 void ErrorHandle::writeProblemToJsonErrorFile(int errorNumber, const std::string &errorMessage, const std::string &errorSolution)
 {
+    std::lock_guard<std::recursive_mutex> lock(logMutex);
     ErrorEntry entry;
     entry.timestamp = getCurrentTime();
     entry.error = errorNumber;
@@ -124,6 +126,7 @@ void ErrorHandle::writeProblemToJsonErrorFile(int errorNumber, const std::string
 
 void ErrorHandle::saveLogFile()
 {
+    std::lock_guard<std::recursive_mutex> lock(logMutex);
     std::cout<<"Saving log file"<<std::endl;
     // Ensure the save directory exists; create it if it doesn't
     if (pathForSave.empty())
@@ -155,41 +158,44 @@ void ErrorHandle::saveLogFile()
     std::ofstream logFile(pathForSave + "/error_log.json");
     if (logFile.is_open())
     {
-        logFile << "{\n";
+        // Messages contain paths and exception texts, the writer escapes them
+        JsonWriter writer("  ");
+        writer.beginObject();
 
         // Write errors
-        logFile << "  \"errors\": [\n";
-        for (size_t i = 0; i < errors.size(); ++i)
+        writer.key("errors");
+        writer.beginArray();
+        for (const ErrorEntry &entry : errors)
         {
-            logFile << "    {\n";
-            logFile << "      \"error code\": " << errors[i].error << ",\n";
-            logFile << "      \"error_message\": \"" << errors[i].error_message << "\",\n";
-            logFile << "      \"error_solution\": \"" << errors[i].error_solution << "\",\n";
-            logFile << "      \"timestamp\": \"" << errors[i].timestamp << "\"\n";
-
-            logFile << "    }";
-            if (i != errors.size() - 1)
-                logFile << ",";
-            logFile << "\n";
+            writer.beginObject();
+            writer.key("error code");
+            writer.value(entry.error);
+            writer.key("error_message");
+            writer.value(entry.error_message);
+            writer.key("error_solution");
+            writer.value(entry.error_solution);
+            writer.key("timestamp");
+            writer.value(entry.timestamp);
+            writer.endObject();
         }
-        logFile << "  ],\n";
+        writer.endArray();
 
         // Write status updates
-        logFile << "  \"status_updates\": [\n";
-        for (size_t i = 0; i < status_updates.size(); ++i)
+        writer.key("status_updates");
+        writer.beginArray();
+        for (const StatusEntry &entry : status_updates)
         {
-            logFile << "    {\n";
-            logFile << "      \"message\": \"" << status_updates[i].message << "\",\n";
-            logFile << "      \"timestamp\": \"" << status_updates[i].timestamp << "\"\n";
-
-            logFile << "    }";
-            if (i != status_updates.size() - 1)
-                logFile << ",";
-            logFile << "\n";
+            writer.beginObject();
+            writer.key("message");
+            writer.value(entry.message);
+            writer.key("timestamp");
+            writer.value(entry.timestamp);
+            writer.endObject();
         }
-        logFile << "  ]\n";
+        writer.endArray();
+        writer.endObject();
 
-        logFile << "}\n";
+        logFile << writer.str() << "\n";
         logFile.close();
 
         // Optionally log that the file was saved successfully
@@ -204,6 +210,7 @@ void ErrorHandle::saveLogFile()
 
 void ErrorHandle::logStatus(const std::string &statusMessage)
 {
+    std::lock_guard<std::recursive_mutex> lock(logMutex);
     if (isUserInterfaceActive)
     {
         std::cout << statusMessage << std::endl;
@@ -221,6 +228,17 @@ void ErrorHandle::startProgram()
         std::cout << "Program started successfully." << std::endl;
     logStatus("Program started successfully.");
 }
+void ErrorHandle::clearLog()
+{
+    std::lock_guard<std::recursive_mutex> lock(logMutex);
+    errors.clear();
+    status_updates.clear();
+}
+int ErrorHandle::getNumberOfErrors()
+{
+    std::lock_guard<std::recursive_mutex> lock(logMutex);
+    return errors.size();
+}
 void ErrorHandle::logLutFileInput(const std::string &lutFileName, int rowsRead)
 {
     std::stringstream ss;
@@ -1,12 +1,79 @@
 #include "../include/FileManager.h"
 #include "../include/ErrorHandle.h"
+#include "../include/JsonWriter.h"
+#include <nlohmann/json.hpp>
+#include <limits>
 #include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <Compression.h>
+#include <TH1D.h>
 #include <sys/stat.h>
 
-FileManager::FileManager(const std::string &inputFilePath, const std::string &savePath, const std::string &delila_name)
+namespace
+{
+    // Writes a parsed value again: arrays of up to two numbers (value and error) stay on one line, as
+    // Histogram::outputPeaksDataJson() writes them
+    void writeJsonValue(JsonWriter &writer, const nlohmann::ordered_json &value)
+    {
+        if (value.is_object())
+        {
+            writer.beginObject();
+            for (auto it = value.begin(); it != value.end(); ++it)
+            {
+                writer.key(it.key());
+                writeJsonValue(writer, it.value());
+            }
+            writer.endObject();
+        }
+        else if (value.is_array())
+        {
+            bool compact = value.size() <= 2;
+            for (const auto &element : value)
+            {
+                compact = compact && (element.is_number() || element.is_null());
+            }
+            writer.beginArray(compact);
+            for (const auto &element : value)
+            {
+                writeJsonValue(writer, element);
+            }
+            writer.endArray();
+        }
+        else if (value.is_number_integer())
+        {
+            writer.value(value.get<int64_t>());
+        }
+        else if (value.is_number())
+        {
+            writer.value(value.get<double>());
+        }
+        else if (value.is_string())
+        {
+            writer.value(value.get<std::string>());
+        }
+        else if (value.is_boolean())
+        {
+            writer.value(value.get<bool>());
+        }
+        else
+        {
+            writer.value(std::numeric_limits<double>::quiet_NaN()); // null
+        }
+    }
+}
+
+FileManager::FileManager(const std::string &inputFilePath, const std::string &savePath, const std::string &delila_name,
+                         int enabledOutputs)
     : inputFilePath(inputFilePath), savePath(savePath), delila_name(delila_name),
+      enabledOutputs(enabledOutputs), keepPreviousOutputs(false), listModeChannels(0), listModeThreads(1), inputTH2Read(false), jsonRecords(0), outputBusySeconds(0), outputJobs(0),
       inputFile(nullptr), outputFileHistograms(nullptr),
-      outputFileCalibrated(nullptr), outputFileTH2(nullptr)
+      outputFileCalibrated(nullptr), outputFileTH2(nullptr), outputFileGammaGamma(nullptr),
+      outputFilePeakTree(nullptr)
 {
 
 }
@@ -16,21 +83,37 @@ FileManager::~FileManager()
     closeFiles();
 }
 
-void FileManager::openFiles()
+bool FileManager::openFiles()
 {
     // Open input file
-    
+    if (RawSpectraFile::isRawSpectraFile(inputFilePath))
+    {
+        if (!rawSpectra.open(inputFilePath))
+        {
+            ErrorHandle::getInstance().errorHandle(ErrorHandle::INVALID_INPUT_FILE);
+            return false;
+        }
+    }
+    else
+    {
+        inputFile = new TFile(inputFilePath.c_str(), "READ");
+    }
 
-    inputFile = new TFile(inputFilePath.c_str(), "READ");
-    
-    if (!inputFile || inputFile->IsZombie())
+    if (!rawSpectra.isOpen() && (!inputFile || inputFile->IsZombie()))
     {
         ErrorHandle::getInstance().errorHandle(ErrorHandle::INVALID_INPUT_FILE);
-        return;
+        return false;
+    }
+    // The events are read once here, only the spectra of the requested domains are kept
+    if (inputFile && !listModeTree.empty() &&
+        !listModeSpectra.read(inputFilePath, listModeTree, listModeDomains, listModeChannels, listModeThreads))
+    {
+        ErrorHandle::getInstance().errorHandle(ErrorHandle::INVALID_INPUT_FILE);
+        return false;
     }
     ErrorHandle::getInstance().logStatus("Opening input file succefuly: " + inputFilePath);
 
-    std::string runName = extractRunNumber();
+    runName = extractRunNumber();
     std::string baseDirectory = extractDirectoryPath();
     std::string saveDirectory;
 
@@ -50,39 +133,86 @@ void FileManager::openFiles()
     if (mkdir(saveDirectory.c_str(), 0777) && errno != EEXIST)
     {
         ErrorHandle::getInstance().logStatus(std::string("Error: Could not create save directory. ") + saveDirectory);
-        return;
+        return false;
     }
     savePath = saveDirectory;
     ErrorHandle::getInstance().logStatus("Opening save path: " + savePath);
-    std::string jsonFilePath = saveDirectory + runName + "_peaks_data.json";
-    jsonFile.open(jsonFilePath);
-    if (!jsonFile.is_open())
+    if (isOutputEnabled(JSON_PEAKS))
     {
-        ErrorHandle::getInstance().logStatus("Error: Could not open JSON file for writing. " + jsonFilePath);
-        return;
+        keepPreviousOutput("_peaks_data.json");
+        std::string jsonFilePath = saveDirectory + runName + "_peaks_data.json";
+        jsonFile.open(jsonFilePath);
+        if (!jsonFile.is_open())
+        {
+            ErrorHandle::getInstance().logStatus("Error: Could not open JSON file for writing. " + jsonFilePath);
+            return false;
+        }
+        jsonFile << "[\n";
+        jsonRecords = 0;
     }
 
-    // Open ROOT files for histograms
-    outputFileHistograms = new TFile((saveDirectory + runName + "_peaks.root").c_str(), "RECREATE");
-    outputFileCalibrated = new TFile((saveDirectory + runName + "_calibrated_histograms.root").c_str(), "RECREATE");
-    outputFileTH2 = new TFile((saveDirectory + runName + "_combinedHistogram.root").c_str(), "RECREATE");
+    // Open ROOT files for histograms, only the requested outputs are created
+    bool outputFilesValid = true;
+    if (isOutputEnabled(ROOT_PEAKS))
+    {
+        keepPreviousOutput("_peaks.root");
+        outputFileHistograms = new TFile((saveDirectory + runName + "_peaks.root").c_str(), "RECREATE", "",
+                                         getCompressionSettings(ROOT_PEAKS));
+        outputFilesValid = outputFilesValid && !outputFileHistograms->IsZombie();
+    }
+    if (isOutputEnabled(ROOT_CALIBRATED))
+    {
+        keepPreviousOutput("_calibrated_histograms.root");
+        outputFileCalibrated = new TFile((saveDirectory + runName + "_calibrated_histograms.root").c_str(), "RECREATE", "",
+                                         getCompressionSettings(ROOT_CALIBRATED));
+        outputFilesValid = outputFilesValid && !outputFileCalibrated->IsZombie();
+    }
+    if (isOutputEnabled(ROOT_COMBINED))
+    {
+        keepPreviousOutput("_combinedHistogram.root");
+        outputFileTH2 = new TFile((saveDirectory + runName + "_combinedHistogram.root").c_str(), "RECREATE", "",
+                                  getCompressionSettings(ROOT_COMBINED));
+        outputFilesValid = outputFilesValid && !outputFileTH2->IsZombie();
+    }
+    if (isOutputEnabled(ROOT_GAMMA_GAMMA))
+    {
+        outputFileGammaGamma = new TFile((saveDirectory + runName + "_calibrated_gammaGamma.root").c_str(), "RECREATE", "",
+                                         getCompressionSettings(ROOT_GAMMA_GAMMA));
+        outputFilesValid = outputFilesValid && !outputFileGammaGamma->IsZombie();
+    }
+    if (isOutputEnabled(ROOT_PEAK_TREE))
+    {
+        keepPreviousOutput("_peak_tree.root");
+        outputFilePeakTree = new TFile((saveDirectory + runName + "_peak_tree.root").c_str(), "RECREATE", "",
+                                       getCompressionSettings(ROOT_PEAK_TREE));
+        outputFilesValid = outputFilesValid && !outputFilePeakTree->IsZombie();
+    }
 
-    if (!outputFileHistograms || outputFileHistograms->IsZombie() || !outputFileCalibrated || outputFileCalibrated->IsZombie() || !outputFileTH2 || outputFileTH2->IsZombie())
+    if (!outputFilesValid)
     {
         ErrorHandle::getInstance().errorHandle(ErrorHandle::INVALID_OUTPUT_FILE);
-        return;
+        return false;
     }
-    ErrorHandle::getInstance().logStatus("Opening output files succefuly: " + saveDirectory + runName + "_peaks.root" + " " + saveDirectory + runName + "_calibrated_histograms.root" + " " + saveDirectory + runName + "_combinedHistogram.root");
+    ErrorHandle::getInstance().logStatus("Opening output files succefuly in: " + saveDirectory);
+    return true;
 }
 
 void FileManager::closeFiles()
 {
+    // Queued outputs still go to the files that are closed here
+    finishOutputWriter();
+
     if (inputFile)
     {
         inputFile->Close();
         delete inputFile;
         inputFile = nullptr;
     }
+    rawSpectra.close();
+    listModeSpectra.clear();
+    inputAxesTH2.reset();
+    inputTH2.reset();
+    inputTH2Read = false;
 
     if (outputFileHistograms)
     {
@@ -105,15 +235,311 @@ void FileManager::closeFiles()
         outputFileTH2 = nullptr;
     }
 
-    if (jsonFile.is_open())
+    if (outputFileGammaGamma)
+    {
+        outputFileGammaGamma->Close();
+        delete outputFileGammaGamma;
+        outputFileGammaGamma = nullptr;
+    }
+
+    if (outputFilePeakTree)
     {
-        jsonFile.close();
+        outputFilePeakTree->Close();
+        delete outputFilePeakTree;
+        outputFilePeakTree = nullptr;
     }
 
+    finishJsonFile();
+    removePreviousOutputs();
+
     ErrorHandle::getInstance().logStatus("Closed files succefuly.");
 
 }
 
+void FileManager::startOutputWriter(size_t queueDepth)
+{
+    if (outputThread.joinable())
+        return;
+    outputQueue.reset(new BoundedQueue<std::function<void()>>(queueDepth));
+    outputBusySeconds = 0;
+    outputJobs = 0;
+    outputThread = std::thread([this]
+                               {
+        std::function<void()> job;
+        while (outputQueue->pop(job))
+        {
+            auto jobStart = std::chrono::steady_clock::now();
+            try
+            {
+                job();
+            }
+            catch (const std::exception &exception)
+            {
+                // A failed write loses that output, the writer goes on with the next job
+                ErrorHandle::getInstance().logStatus(std::string("Output writer: a job failed: ") + exception.what());
+            }
+            job = nullptr; // whatever the job captured is released before waiting for the next one
+            outputBusySeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - jobStart).count();
+            ++outputJobs;
+        } });
+}
+
+void FileManager::submitOutput(std::function<void()> job)
+{
+    if (outputThread.joinable())
+    {
+        outputQueue->push(std::move(job));
+    }
+    else
+    {
+        job();
+    }
+}
+
+double FileManager::finishOutputWriter()
+{
+    if (!outputThread.joinable())
+        return 0;
+    auto drainStart = std::chrono::steady_clock::now();
+    outputQueue->close();
+    outputThread.join();
+    outputQueue.reset();
+    double drainSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - drainStart).count();
+    ErrorHandle::getInstance().logStatus("Output writer: " + std::to_string(outputJobs) + " jobs, busy " +
+                                         std::to_string(outputBusySeconds) + " s, " + std::to_string(drainSeconds) +
+                                         " s waited for it at the end.");
+    return outputBusySeconds;
+}
+
+void FileManager::setListModeInput(const std::string &treeName, int channels, const std::vector<int> &domains, int threads)
+{
+    listModeTree = treeName;
+    listModeChannels = channels;
+    listModeDomains = domains;
+    listModeThreads = threads;
+}
+
+void FileManager::writeJsonRecord(const std::string &record)
+{
+    if (!jsonFile.is_open())
+        return;
+    if (jsonRecords++ > 0)
+    {
+        jsonFile << ",\n";
+    }
+    jsonFile << record;
+}
+
+void FileManager::finishJsonFile()
+{
+    if (!jsonFile.is_open())
+        return;
+    jsonFile << (jsonRecords > 0 ? "\n]\n" : "]\n");
+    jsonFile.close();
+}
+
+std::map<int, std::string> FileManager::readJsonRecords(const std::string &path)
+{
+    // The file is parsed as JSON, whatever its layout, and every record is written again in the layout
+    // of writeJsonRecord(); the keys keep their order. A file that does not parse gives no records.
+    std::map<int, std::string> records;
+    std::ifstream file(path);
+    if (!file.is_open())
+    {
+        return records;
+    }
+    nlohmann::ordered_json jsonData;
+    try
+    {
+        file >> jsonData;
+    }
+    catch (const std::exception &exception)
+    {
+        ErrorHandle::getInstance().logStatus("Error: Could not parse " + path + ": " + exception.what());
+        return records;
+    }
+    if (!jsonData.is_array())
+    {
+        return records;
+    }
+    JsonWriter writer("\t", 1);
+    for (const auto &item : jsonData)
+    {
+        auto domain = item.is_object() ? item.find("domain") : item.end();
+        if (domain == item.end() || !domain->is_number_integer() || domain->get<int>() < 0)
+        {
+            continue;
+        }
+        writer.clear();
+        writeJsonValue(writer, item);
+        records[domain->get<int>()] = writer.str();
+    }
+    return records;
+}
+
+bool FileManager::writeJsonRecords(const std::string &path, const std::map<int, std::string> &records)
+{
+    std::ofstream file(path);
+    if (!file.is_open())
+    {
+        ErrorHandle::getInstance().logStatus("Error: Could not open JSON file for writing. " + path);
+        return false;
+    }
+    file << "[\n";
+    bool first = true;
+    for (const auto &record : records)
+    {
+        file << (first ? "" : ",\n") << record.second;
+        first = false;
+    }
+    file << (first ? "]\n" : "\n]\n");
+    return file.good();
+}
+
+int FileManager::getCompressionSettings(OutputFile output) const
+{
+    auto it = compressionProfiles.find(output);
+    return getCompressionSettings(it != compressionProfiles.end() ? it->second : COMPRESSION_DEFAULT);
+}
+
+int FileManager::getCompressionSettings(CompressionProfile profile)
+{
+    using Algorithm = ROOT::RCompressionSetting::EAlgorithm;
+    switch (profile)
+    {
+    case COMPRESSION_NONE:
+        return 0;
+    case COMPRESSION_FAST:
+        return ROOT::CompressionSettings(Algorithm::kLZ4, 1);
+    case COMPRESSION_ARCHIVE:
+        return ROOT::CompressionSettings(Algorithm::kZSTD, 9);
+    default:
+        return ROOT::RCompressionSetting::EDefaults::kUseGeneralPurpose;
+    }
+}
+
+const char *FileManager::getCompressionProfileName(CompressionProfile profile)
+{
+    switch (profile)
+    {
+    case COMPRESSION_NONE:
+        return "none";
+    case COMPRESSION_FAST:
+        return "fast";
+    case COMPRESSION_ARCHIVE:
+        return "archive";
+    default:
+        return "default";
+    }
+}
+
+bool FileManager::parseCompressionProfile(const std::string &name, CompressionProfile &profile)
+{
+    for (CompressionProfile candidate : {COMPRESSION_DEFAULT, COMPRESSION_NONE, COMPRESSION_FAST, COMPRESSION_ARCHIVE})
+    {
+        if (name == getCompressionProfileName(candidate))
+        {
+            profile = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+void FileManager::benchmarkCompression()
+{
+    TH2F *th2Histogram = getTH2Histogram();
+    if (!th2Histogram)
+    {
+        ErrorHandle::getInstance().logStatus("Compression benchmark: no TH2 histogram " + delila_name + " in " + inputFilePath);
+        return;
+    }
+
+    // The outputs are the combined TH2 and one spectrum per detector, the benchmark writes the same objects
+    std::vector<std::unique_ptr<TH1D>> spectra;
+    for (int column = 1; column <= th2Histogram->GetNbinsX(); ++column)
+    {
+        std::unique_ptr<TH1D> spectrum(th2Histogram->ProjectionY(("benchmark_" + std::to_string(column)).c_str(), column, column));
+        spectrum->SetDirectory(nullptr);
+        if (spectrum->GetEntries() > 0)
+        {
+            spectra.push_back(std::move(spectrum));
+        }
+    }
+
+    ErrorHandle::getInstance().logStatus("Compression benchmark on " + inputFilePath + ": TH2 and " +
+                                         std::to_string(spectra.size()) + " detector spectra per file.");
+    double uncompressedBytes = 0;
+    for (CompressionProfile profile : {COMPRESSION_NONE, COMPRESSION_FAST, COMPRESSION_DEFAULT, COMPRESSION_ARCHIVE})
+    {
+        std::string path = savePath + runName + "_compression_" + getCompressionProfileName(profile) + ".root";
+        auto writeStart = std::chrono::steady_clock::now();
+        {
+            TFile file(path.c_str(), "RECREATE", "", getCompressionSettings(profile));
+            if (file.IsZombie())
+            {
+                ErrorHandle::getInstance().logStatus("Compression benchmark: could not create " + path);
+                return;
+            }
+            file.cd();
+            th2Histogram->Write();
+            for (const auto &spectrum : spectra)
+            {
+                spectrum->Write();
+            }
+            file.Close();
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - writeStart).count();
+
+        struct stat fileStatus;
+        double bytes = stat(path.c_str(), &fileStatus) == 0 ? fileStatus.st_size : 0;
+        std::remove(path.c_str());
+        if (profile == COMPRESSION_NONE)
+        {
+            uncompressedBytes = bytes;
+        }
+        std::ostringstream line;
+        line << std::fixed << std::setprecision(3) << std::left << std::setw(8) << getCompressionProfileName(profile)
+             << " settings " << std::setw(4) << getCompressionSettings(profile) << " write " << seconds << " s, size "
+             << bytes / (1 << 20) << " MiB, ratio " << (bytes > 0 ? uncompressedBytes / bytes : 0);
+        ErrorHandle::getInstance().logStatus(line.str());
+    }
+}
+
+void FileManager::setInput(const std::string &newInputFilePath, const std::string &newSavePath)
+{
+    closeFiles();
+    inputFilePath = newInputFilePath;
+    savePath = newSavePath;
+    runName.clear();
+}
+
+void FileManager::keepPreviousOutput(const std::string &suffix)
+{
+    if (!keepPreviousOutputs)
+        return;
+    // The .previous files are only removed after a complete run. One that is still there belongs to a run
+    // that stopped (crash, kill) and is the last complete output, the current file is partial then.
+    struct stat previousStatus;
+    if (stat(getPreviousOutputFilePath(suffix).c_str(), &previousStatus) == 0)
+    {
+        ErrorHandle::getInstance().logStatus("Incremental: keeping " + getPreviousOutputFilePath(suffix) + " of an interrupted run.");
+        return;
+    }
+    std::rename(getOutputFilePath(suffix).c_str(), getPreviousOutputFilePath(suffix).c_str());
+}
+
+void FileManager::removePreviousOutputs()
+{
+    if (!keepPreviousOutputs || runName.empty())
+        return;
+    for (const char *suffix : {"_peaks_data.json", "_peaks.root", "_calibrated_histograms.root", "_combinedHistogram.root",
+                               "_peak_tree.root"})
+    {
+        std::remove(getPreviousOutputFilePath(suffix).c_str());
+    }
+}
+
 std::string FileManager::removeFileExtension() const
 {
     size_t lastDot = inputFilePath.find_last_of('.');
@@ -165,19 +591,57 @@ std::string FileManager::extractDirectoryPath() const
 TH2F *FileManager::getTH2Histogram() const
 {
     TH2F *histogram = nullptr;
-    if (inputFile)
+    if (rawSpectra.isOpen() || listModeSpectra.isLoaded())
     {
-        inputFile->GetObject(delila_name.c_str(), histogram);
-        if (!histogram)
+        if (!inputAxesTH2)
         {
-            ErrorHandle::getInstance().errorHandle(ErrorHandle::INVALID_TH2F_HISTOGRAM);
+            inputAxesTH2 = rawSpectra.isOpen() ? rawSpectra.createEmptyHistogram(delila_name)
+                                               : listModeSpectra.createEmptyHistogram(delila_name);
         }
+        histogram = inputAxesTH2.get();
+    }
+    else if (inputFile)
+    {
+        // Read once per input: with TH1::AddDirectory(false) every GetObject() is a new copy that no
+        // directory owns, so the FileManager owns this one and detaches it from the file in any case
+        if (!inputTH2Read)
+        {
+            inputTH2Read = true;
+            TH2F *readHistogram = nullptr;
+            inputFile->GetObject(delila_name.c_str(), readHistogram);
+            if (readHistogram)
+            {
+                readHistogram->SetDirectory(nullptr);
+                inputTH2.reset(readHistogram);
+            }
+            else
+            {
+                ErrorHandle::getInstance().errorHandle(ErrorHandle::INVALID_TH2F_HISTOGRAM);
+            }
+        }
+        histogram = inputTH2.get();
     }
     return histogram;
 }
 
+TDirectory *FileManager::getInputDirectory(const std::string &name) const
+{
+    TDirectory *directory = nullptr;
+    if (inputFile)
+    {
+        directory = inputFile->GetDirectory(name.c_str());
+        if (!directory)
+        {
+            ErrorHandle::getInstance().logStatus("Directory " + name + " not found in the input file.");
+        }
+    }
+    return directory;
+}
+
 void FileManager::saveTH2Histogram(TH2F *const th2Histogram)
 {
+    if (!outputFileTH2)
+        return;
     outputFileTH2->cd();
     th2Histogram->Write();
 }
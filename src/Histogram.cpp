@@ -1,6 +1,8 @@
 #include "../include/Histogram.h"
 #include "../include/EliadeMathFunctions.h"
 #include "../include/ErrorHandle.h"
+#include <algorithm>
+#include <cstdlib>
 //#include <iostream>
 //#include <fstream>
 //#include <cmath>
@@ -14,99 +16,51 @@ namespace
 {
     constexpr float MAX_DISTANCE = 10;
     constexpr float MIN_DISTANCE = 1.9f;
+    // Gaussian peak on a quadratic background, FIT_PARAMETERS of CalibrationCache must match
+    const char *GAUSSIAN_FIT_FORMULA = "[0]*exp(-0.5*((x-[1])/[2])**2) + [3] + ([4]*x) + ([5]*x*x)";
+
+    // Owned copy that is not registered in gDirectory
+    std::unique_ptr<TH1D> cloneHistogram(const TH1D &histogram)
+    {
+        std::unique_ptr<TH1D> clone(static_cast<TH1D *>(histogram.Clone()));
+        clone->SetDirectory(nullptr);
+        return clone;
+    }
 }
 
 // Constructor implementations
 Histogram::Histogram() : xMin(0), xMax(0), maxFWHM(0), minAmplitude(0), maxAmplitude(0),
-                         numberOfPeaks(0), mainHist(nullptr), tempHist(nullptr), calibratedHist(nullptr),
+                         numberOfPeaks(0),
                          m(0), b(0), polynomialDegree(0), peakMatchCount(0), // Changed from polinomDegree
                          polynomialFitThreshold(1e-3),
                          TH2histogram_name("An empty histogram"),
                          sourceName("Empty source"),
                          peakCount(0),
                          totalArea(0),
-                         totalAreaError(0)
+                         totalAreaError(0),
+                         activeFirstBin(1), activeLastBin(0)
 {
 }
 
 Histogram::Histogram(int xMin, int xMax, int maxFWHM, float minAmplitude, float maxAmplitude,
                      const std::string &serial, int detType, float polynomialFitThreshold, int numberOfPeaks,
-                     TH1D *mainHist, const std::string &TH2histogram_name, const std::string &sourceName)
+                     std::unique_ptr<TH1D> mainHist, const std::string &TH2histogram_name, const std::string &sourceName)
     : xMin(xMin), xMax(xMax), maxFWHM(maxFWHM), minAmplitude(minAmplitude), maxAmplitude(maxAmplitude),
       serial(serial), detType(detType), polynomialFitThreshold(polynomialFitThreshold), numberOfPeaks(numberOfPeaks),
-      mainHist(mainHist), tempHist(nullptr), calibratedHist(nullptr),
+      mainHist(std::move(mainHist)),
       m(0), b(0), polynomialDegree(0), peakMatchCount(0),
       TH2histogram_name(TH2histogram_name), sourceName(sourceName),
-      peakCount(0), totalArea(0), totalAreaError(0)
+      peakCount(0), totalArea(0), totalAreaError(0),
+      activeFirstBin(1), activeLastBin(this->mainHist ? this->mainHist->GetNbinsX() : 0)
 {
-    if (mainHist)
+    if (this->mainHist)
     {
-        this->tempHist = (TH1D *)mainHist->Clone();
-        this->calibratedHist = (TH1D *)mainHist->Clone();
+        this->mainHist->SetDirectory(nullptr);
+        tempHist = cloneHistogram(*this->mainHist);
     }
 }
 
-Histogram::~Histogram()
-{
-    // Consider using smart pointers to manage memory automatically
-    // if (tempHist) { delete tempHist; tempHist = nullptr; }
-    // if (calibratedHist) { delete calibratedHist; calibratedHist = nullptr; }
-}
-
-Histogram::Histogram(const Histogram &histogram)
-    : xMin(histogram.xMin), xMax(histogram.xMax), maxFWHM(histogram.maxFWHM),
-      minAmplitude(histogram.minAmplitude), maxAmplitude(histogram.maxAmplitude),
-      numberOfPeaks(histogram.numberOfPeaks), serial(histogram.serial), detType(histogram.detType),
-      polynomialFitThreshold(histogram.polynomialFitThreshold), m(histogram.m), b(histogram.b),
-      peakMatchCount(histogram.peakMatchCount), polynomialDegree(histogram.polynomialDegree), // Changed from polinomDegree
-      TH2histogram_name(histogram.TH2histogram_name), sourceName(histogram.sourceName),
-      peakCount(histogram.peakCount), totalArea(histogram.totalArea), totalAreaError(histogram.totalAreaError)
-{
-    mainHist = (histogram.mainHist) ? (TH1D *)histogram.mainHist->Clone() : nullptr;
-    tempHist = (histogram.tempHist) ? (TH1D *)histogram.tempHist->Clone() : nullptr;
-    calibratedHist = (histogram.calibratedHist) ? (TH1D *)histogram.calibratedHist->Clone() : nullptr;
-    peaks = histogram.peaks;
-    coefficients = histogram.coefficients;
-}
-
-Histogram &Histogram::operator=(const Histogram &histogram)
-{
-    if (this != &histogram)
-    {
-        if (mainHist)
-            delete mainHist;
-        if (tempHist)
-            delete tempHist;
-        if (calibratedHist)
-            delete calibratedHist;
-
-        xMin = histogram.xMin;
-        xMax = histogram.xMax;
-        maxFWHM = histogram.maxFWHM;
-        minAmplitude = histogram.minAmplitude;
-        maxAmplitude = histogram.maxAmplitude;
-        numberOfPeaks = histogram.numberOfPeaks;
-        serial = histogram.serial;
-        detType = histogram.detType;
-        polynomialFitThreshold = histogram.polynomialFitThreshold;
-        m = histogram.m;
-        b = histogram.b;
-        peakMatchCount = histogram.peakMatchCount;
-        polynomialDegree = histogram.polynomialDegree;
-        TH2histogram_name = histogram.TH2histogram_name;
-        sourceName = histogram.sourceName;
-        peakCount = histogram.peakCount;
-        totalArea = histogram.totalArea;
-        totalAreaError = histogram.totalAreaError;
-
-        mainHist = (histogram.mainHist) ? (TH1D *)histogram.mainHist->Clone() : nullptr;
-        tempHist = (histogram.tempHist) ? (TH1D *)histogram.tempHist->Clone() : nullptr;
-        calibratedHist = (histogram.calibratedHist) ? (TH1D *)histogram.calibratedHist->Clone() : nullptr;
-        peaks = histogram.peaks;
-        coefficients = histogram.coefficients;
-    }
-    return *this;
-}
+Histogram::~Histogram() = default;
 
 // peak detection section
 void Histogram::findPeaks()
@@ -158,7 +112,7 @@ TF1 *Histogram::createGaussianFit(int maxBin)
 {
     float maxPeakX = mainHist->GetXaxis()->GetBinCenter(maxBin);
     // is good to use [0]*exp(-0.5*((x-[1])/[2])**2) + [3] + ([4]*x) to fit the gaussian
-    TF1 *gaus = new TF1(Form("gausFit_%d", peakCount), "[0]*exp(-0.5*((x-[1])/[2])**2) + [3] + ([4]*x) + ([5]*x*x)", maxPeakX - 10, maxPeakX + 10);
+    TF1 *gaus = new TF1(Form("gausFit_%d", peakCount), GAUSSIAN_FIT_FORMULA, maxPeakX - 10, maxPeakX + 10);
     gaus->SetParameters(tempHist->GetBinContent(maxBin), maxPeakX, 1.0, 0.0, 0.0, 0.0);
     gaus->SetParLimits(2, 0.1, 10.0);
     return gaus;
@@ -173,7 +127,8 @@ int Histogram::findMaxBin()
     double leftLimit = MIN_DISTANCE;
     double rightLimit = MIN_DISTANCE;
 
-    for (int bin = 1; bin <= tempHist->GetNbinsX(); ++bin)
+    // tempHist only loses counts while peaks are eliminated, the active range stays valid
+    for (int bin = activeFirstBin; bin <= activeLastBin; ++bin)
     {
         float binContent = tempHist->GetBinContent(bin);
         if (binContent == 0)
@@ -216,7 +171,7 @@ int Histogram::detectAndFitPeaks()
 
     TF1 *gaus = createGaussianFit(maxBin);
     tempHist->Fit(gaus, "RQ");
-    peaks.emplace_back(gaus, mainHist);
+    peaks.emplace_back(gaus, mainHist.get());
 
     if (!checkConditions(peaks.back()))
     {
@@ -357,6 +312,59 @@ void Histogram::calibratePeaksByDegree()
     }
 }
 
+// Cache section
+CalibrationCache::Result Histogram::exportResults() const
+{
+    CalibrationCache::Result result;
+    result.coefficients = coefficients;
+    result.peakMatchCount = peakMatchCount;
+    for (const Peak &peak : peaks)
+    {
+        CalibrationCache::PeakRecord record = {};
+        if (const TF1 *gaus = peak.getGaussianFunction())
+        {
+            for (int i = 0; i < CalibrationCache::FIT_PARAMETERS; ++i)
+            {
+                record.parameters[i] = gaus->GetParameter(i);
+                record.errors[i] = gaus->GetParError(i);
+            }
+            record.rangeMin = gaus->GetXmin();
+            record.rangeMax = gaus->GetXmax();
+        }
+        record.associatedPosition = peak.getAssociatedPosition();
+        record.area = peak.getArea();
+        record.areaError = peak.getAreaError();
+        result.peaks.push_back(record);
+    }
+    return result;
+}
+
+void Histogram::importResults(const CalibrationCache::Result &result, const std::string &source)
+{
+    peaks.clear();
+    for (size_t i = 0; i < result.peaks.size(); ++i)
+    {
+        const CalibrationCache::PeakRecord &record = result.peaks[i];
+        // Peak takes position, amplitude, sigma and limits from the function, the areas are the stored ones
+        TF1 gaus(Form("gausFit_%zu", i), GAUSSIAN_FIT_FORMULA, record.rangeMin, record.rangeMax);
+        for (int parameter = 0; parameter < CalibrationCache::FIT_PARAMETERS; ++parameter)
+        {
+            gaus.SetParameter(parameter, record.parameters[parameter]);
+            gaus.SetParError(parameter, record.errors[parameter]);
+        }
+        Peak peak(&gaus);
+        peak.setAssociatedPosition(record.associatedPosition);
+        peak.setArea(record.area);
+        peak.setAreaError(record.areaError);
+        peaks.push_back(std::move(peak));
+    }
+    peakCount = peaks.size();
+    peakMatchCount = result.peakMatchCount;
+    coefficients = result.coefficients;
+    calibrationDegree = coefficients.empty() ? 0 : static_cast<int>(coefficients.size()) - 1;
+    ErrorHandle::getInstance().logStatus("Peaks and calibration taken from the " + source + ": " + std::to_string(peaks.size()) + " peaks.");
+}
+
 // V2 calibration section //removed, available in the previous version on github
 
 // Apply calibration section
@@ -367,141 +375,122 @@ void Histogram::initializeCalibratedHist()
         return;
     }
 
+    // Only built when the calibrated histograms are written, keeps the name of the main histogram
     if (calibratedHist == nullptr)
     {
-        int numBins = mainHist->GetNbinsX();
-        double xMin = mainHist->GetXaxis()->GetXmin();
-        double xMax = mainHist->GetXaxis()->GetXmax();
-        calibratedHist = new TH1D("calibratedHist", "Calibrated Histogram", numBins, xMin, xMax);
+        calibratedHist = cloneHistogram(*mainHist);
     }
 }
 
-void Histogram::interpolateBins(int start_bin, int end_bin, double start_value, double end_value, double start_position, double end_position)
+CalibrationRebinner Histogram::createRebinner() const
 {
-    if (end_bin > start_bin)
-    {
-        double distance = end_position - start_position;
-
-        for (int i = start_bin + 1; i < end_bin; ++i)
-        {
-            double fraction = (calibratedHist->GetXaxis()->GetBinCenter(i) - start_position) / distance;
-
-            double interpolated_content = start_value + fraction * (end_value - start_value);
-
-            calibratedHist->SetBinContent(i, interpolated_content);
-        }
-    }
+    const TAxis *axis = mainHist->GetXaxis();
+    return CalibrationRebinner(coefficients,
+                               axis->GetNbins(), axis->GetXmin(), axis->GetXmax(),
+                               axis->GetNbins(), axis->GetXmin(), axis->GetXmax());
 }
 
-void Histogram::setCalibratedBinContent(int original_bin)
+void Histogram::applyXCalibration()
 {
-    double binCenter_original = mainHist->GetXaxis()->GetBinCenter(original_bin);
-
-    double binCenter_calibrated = evaluateCalibrationPolynomial(binCenter_original);
-
-    double binContent = mainHist->GetBinContent(original_bin);
-
-    int corresponding_bin_calibrated = calibratedHist->GetXaxis()->FindBin(binCenter_calibrated);
-
-    if (corresponding_bin_calibrated < 1 || corresponding_bin_calibrated > calibratedHist->GetNbinsX())
+    initializeCalibratedHist();
+    if (calibratedHist == nullptr)
     {
-        calibratedHist->SetBinContent(corresponding_bin_calibrated, 0);
+        return;
     }
-    else
+
+    calibratedHist->Reset();
+    if (coefficients.empty())
     {
-        calibratedHist->SetBinContent(corresponding_bin_calibrated, binContent);
+        ErrorHandle::getInstance().logStatus("No calibration coefficients, calibrated histogram left empty.");
+        return;
     }
-}
 
-double Histogram::evaluateCalibrationPolynomial(double binCenter_original) const
-{
-    double binCenter_calibrated = 0;
-    double binCenter_power = 1;
-    for (size_t i = 0; i < coefficients.size(); ++i)
+    CalibrationRebinner rebinner = createRebinner();
+    if (!rebinner.isValid())
     {
-        binCenter_calibrated += coefficients[i] * binCenter_power;
-        binCenter_power *= binCenter_original;
+        ErrorHandle::getInstance().logStatus("Calibration gives non-finite energies, calibrated histogram left empty.");
+        return;
     }
+    rebinner.rebin(mainHist->GetArray(), calibratedHist->GetArray(), activeFirstBin, activeLastBin);
 
-    return binCenter_calibrated;
+    // Errors of redistributed counts are taken as Poisson, the statistics are rebuilt from the new contents
+    calibratedHist->Sumw2(false);
+    calibratedHist->ResetStats();
 }
 
-void Histogram::applyXCalibration()
+void Histogram::applyXCalibration(float *calibratedColumn) const
 {
-    initializeCalibratedHist();
-    int numBinsOriginal = mainHist->GetNbinsX();
-
-    for (int new_bin = 1; new_bin <= numBinsOriginal; ++new_bin)
+    if (mainHist == nullptr || calibratedColumn == nullptr || coefficients.empty())
     {
-        setCalibratedBinContent(new_bin);
-
-        if (new_bin < numBinsOriginal)
-        {
-            double nextBinCenter_original = mainHist->GetXaxis()->GetBinCenter(new_bin + 1);
-            double nextBinCenter_calibrated = evaluateCalibrationPolynomial(nextBinCenter_original);
-            double nextBinContent = mainHist->GetBinContent(new_bin + 1);
-
-            double binCenter_original_calibrated = evaluateCalibrationPolynomial(mainHist->GetXaxis()->GetBinCenter(new_bin));
-            int current_bin_calibrated = calibratedHist->GetXaxis()->FindBin(binCenter_original_calibrated);
-            int next_bin_calibrated = calibratedHist->GetXaxis()->FindBin(nextBinCenter_calibrated);
-
-            interpolateBins(current_bin_calibrated, next_bin_calibrated,
-                            mainHist->GetBinContent(new_bin), nextBinContent,
-                            binCenter_original_calibrated, nextBinCenter_calibrated);
-        }
+        return;
     }
+    CalibrationRebinner rebinner = createRebinner();
+    if (!rebinner.isValid())
+    {
+        ErrorHandle::getInstance().logStatus("Calibration gives non-finite energies, column left out of the combined histogram.");
+        return;
+    }
+    rebinner.rebin(mainHist->GetArray(), calibratedColumn, activeFirstBin, activeLastBin);
 }
 
-// output section
-void Histogram::outputPeaksDataJson(std::ofstream &jsonFile)
+void Histogram::setActiveRange(int firstBin, int lastBin)
 {
-    // jsonFile << "[\n";
-    jsonFile << "\t{\n";
-    jsonFile << "\t\t\"domain\": " << getMainHistName() << ",\n";
-    jsonFile << "\t\t\"serial\": \"" << serial << "\",\n";
-    jsonFile << "\t\t\"detType\": " << detType << ",\n";
-    jsonFile << "\t\t\"PT\": [";
-    jsonFile << getPT() << ", " << getPTError();
-    jsonFile << "],\n";
-
-    jsonFile << "\t\t\"pol_list\": [\n";
-    for (size_t i = 0; i < coefficients.size(); ++i)
-    {
-        jsonFile << "\t\t\t" << coefficients[i];
-        if (i < coefficients.size() - 1)
-        {
-            jsonFile << ",";
-        }
-        jsonFile << "\n";
-    }
-    jsonFile << "\t\t],\n";
-
-    jsonFile << "\t\t\"" << sourceName << "\": {\n";
-
-    for (size_t i = 0; i < peaks.size(); ++i)
+    if (mainHist == nullptr)
     {
-        jsonFile << "\t\t\t\"" << peaks[i].getAssociatedPosition() << "\": {\n";
-        // jsonFile << "\t\t\t\t\"eff\": [" << peaks[i].getEfficiency() << ", " << peaks[i].getEffError() << "],\n";
-        jsonFile << "\t\t\t\t\"res\": [" << peaks[i].calculateResolution() << ", " << peaks[i].calculateResolutionError() << "],\n";
-        jsonFile << "\t\t\t\t\"pos_ch\": " << peaks[i].getPosition() << ",\n";
-        jsonFile << "\t\t\t\t\"area\": [" << peaks[i].getArea() << ", " << peaks[i].getAreaError() << "]\n";
-
-        if (i < peaks.size() - 1)
-        {
-            jsonFile << "\t\t\t},\n";
-        }
-        else
-        {
-            jsonFile << "\t\t\t\n";
-        }
+        return;
     }
+    // Bins outside the range must be empty, e.g. taken from ColumnStatistics of the source column
+    activeFirstBin = std::max(firstBin, 1);
+    activeLastBin = std::min(lastBin, mainHist->GetNbinsX());
+}
 
-    jsonFile << "\t\t}\n";
-    jsonFile << "\t},\n";
-    // jsonFile << "]\n";
-    ErrorHandle::getInstance().logStatus("Peaks data saved successfully in Json.");
-    ErrorHandle::getInstance().logStatus("end------------------------------------------------.");
-
+// output section
+void Histogram::outputPeaksDataJson(JsonWriter &writer)
+{
+    // One element of the _peaks_data.json array, FileManager::writeJsonRecord adds the separators
+    writer.beginObject();
+    writer.key("domain");
+    writer.value(std::atoi(getMainHistName().c_str()));
+    writer.key("serial");
+    writer.value(serial);
+    writer.key("detType");
+    writer.value(detType);
+    writer.key("PT");
+    writer.beginArray(true);
+    writer.value(getPT());
+    writer.value(getPTError());
+    writer.endArray();
+
+    writer.key("pol_list");
+    writer.beginArray();
+    for (double coefficient : coefficients)
+    {
+        writer.value(coefficient);
+    }
+    writer.endArray();
+
+    writer.key(sourceName);
+    writer.beginObject();
+    for (const Peak &peak : peaks)
+    {
+        writer.key(peak.getAssociatedPosition());
+        writer.beginObject();
+        writer.key("res");
+        writer.beginArray(true);
+        writer.value(peak.calculateResolution());
+        writer.value(peak.calculateResolutionError());
+        writer.endArray();
+        writer.key("pos_ch");
+        writer.value(peak.getPosition());
+        writer.key("area");
+        writer.beginArray(true);
+        writer.value(peak.getArea());
+        writer.value(peak.getAreaError());
+        writer.endArray();
+        writer.endObject();
+    }
+    writer.endObject();
+    writer.endObject();
 }
 
 void Histogram::printHistogramWithPeaksRoot(TFile *outputFile)
@@ -519,7 +508,8 @@ void Histogram::printHistogramWithPeaksRoot(TFile *outputFile)
     for (int i = 0; i < peaks.size(); ++i)
     {
         double newPosition = peaks[i].getPosition();
-        TF1 *gaussianFunction = createGaussianFit(newPosition);
+        // Fit() keeps its own copy of the function in mainHist, this one is released after the fit
+        std::unique_ptr<TF1> gaussianFunction(createGaussianFit(newPosition));
         if (gaussianFunction)
         {
             if (peaks[i].getAssociatedPosition() == 0)
@@ -528,7 +518,7 @@ void Histogram::printHistogramWithPeaksRoot(TFile *outputFile)
             }
             gaussianFunction->SetName(Form("gaussian_%d", i));
             gaussianFunction->SetTitle(Form("Gaussian %d", i));
-            mainHist->Fit(gaussianFunction, "RQ+");
+            mainHist->Fit(gaussianFunction.get(), "RQ+");
         }
     }
 
@@ -542,6 +532,10 @@ void Histogram::printCalibratedHistogramRoot(TFile *outputFile) const
         ErrorHandle::getInstance().logStatus("Error: Could not open file for writing in printCalibratedHistogramRoot, filed output its not send corectly.");
         return;
     }
+    if (!calibratedHist)
+    {
+        return;
+    }
     outputFile->cd();
     calibratedHist->Write();
 }
@@ -550,7 +544,7 @@ void Histogram::printCalibratedHistogramRoot(TFile *outputFile) const
 void Histogram::setTotalArea()
 {
     totalArea = 0;
-    for (int bin = 1; bin <= mainHist->GetNbinsX(); ++bin)
+    for (int bin = activeFirstBin; bin <= activeLastBin; ++bin)
     {
         totalArea += mainHist->GetBinContent(bin) * mainHist->GetBinWidth(bin);
     }
@@ -559,7 +553,7 @@ void Histogram::setTotalArea()
 void Histogram::setTotalAreaError()
 {
     totalAreaError = 0;
-    for (int bin = 1; bin <= mainHist->GetNbinsX(); ++bin)
+    for (int bin = activeFirstBin; bin <= activeLastBin; ++bin)
     {
         double binError = mainHist->GetBinError(bin);
         double binWidth = mainHist->GetBinWidth(bin);
@@ -638,25 +632,24 @@ void Histogram::changePeak(int peakNumber, double newPosition)
         return;
     }
 
-    // Use C++-style cast
-    TF1 *gaus = createGaussianFit(static_cast<int>(newPosition));
+    // Peak keeps its own copy of the fit function
+    std::unique_ptr<TF1> gaus(createGaussianFit(static_cast<int>(newPosition)));
     if (gaus == nullptr)
     {
         std::cerr << "Error: Failed to create Gaussian fit." << std::endl;
         return;
     }
 
-    tempHist->Fit(gaus, "RQ");
+    tempHist->Fit(gaus.get(), "RQ");
 
     eliminatePeak(peaks[peakNumber]);
 
-    peaks[peakNumber] = Peak(gaus, mainHist);
+    peaks[peakNumber] = Peak(gaus.get(), mainHist.get());
     std::cout << "Peak number: " << peakNumber << std::endl;
     std::cout << "Peak position: " << peaks[peakNumber].getPosition() << std::endl;
     if (!checkConditions(peaks[peakNumber]))
     {
         peaks.erase(peaks.begin() + peakNumber);
-        delete gaus;
         return;
     }
 }
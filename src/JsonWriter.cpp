@@ -0,0 +1,192 @@
+#include "../include/JsonWriter.h"
+#include <charconv>
+#include <cmath>
+
+JsonWriter::JsonWriter(const std::string &indent, int baseDepth)
+    : indent(indent), baseDepth(baseDepth), depth(0), afterKey(false)
+{
+    hasElements[0] = false;
+    compact[0] = false;
+}
+
+void JsonWriter::clear()
+{
+    buffer.clear();
+    depth = 0;
+    hasElements[0] = false;
+    afterKey = false;
+}
+
+void JsonWriter::newLine(int level)
+{
+    buffer += '\n';
+    for (int i = 0; i < baseDepth + level; ++i)
+    {
+        buffer += indent;
+    }
+}
+
+void JsonWriter::beginValue()
+{
+    // A value after a key continues its line, the other values are separated from the previous element
+    if (afterKey)
+    {
+        afterKey = false;
+        return;
+    }
+    if (depth == 0)
+    {
+        for (int i = 0; i < baseDepth; ++i)
+        {
+            buffer += indent;
+        }
+        return;
+    }
+    if (hasElements[depth])
+    {
+        buffer += compact[depth] ? ", " : ",";
+    }
+    if (!compact[depth])
+    {
+        newLine(depth);
+    }
+    hasElements[depth] = true;
+}
+
+void JsonWriter::beginContainer(char open, bool compactContainer)
+{
+    beginValue();
+    buffer += open;
+    if (depth + 1 < MAX_DEPTH)
+    {
+        ++depth;
+        hasElements[depth] = false;
+        // The content of a compact container stays on its line
+        compact[depth] = compactContainer || compact[depth - 1];
+    }
+}
+
+void JsonWriter::endContainer(char close)
+{
+    if (depth > 0)
+    {
+        if (hasElements[depth] && !compact[depth])
+        {
+            newLine(depth - 1);
+        }
+        --depth;
+    }
+    buffer += close;
+}
+
+void JsonWriter::key(const std::string &name)
+{
+    beginValue();
+    appendString(name);
+    buffer += ": ";
+    afterKey = true;
+}
+
+void JsonWriter::key(double number)
+{
+    beginValue();
+    buffer += '"';
+    appendNumber(number);
+    buffer += "\": ";
+    afterKey = true;
+}
+
+void JsonWriter::value(double number)
+{
+    beginValue();
+    appendNumber(number);
+}
+
+void JsonWriter::value(float number)
+{
+    beginValue();
+    appendNumber(number);
+}
+
+void JsonWriter::value(int64_t number)
+{
+    beginValue();
+    char digits[24];
+    std::to_chars_result result = std::to_chars(digits, digits + sizeof(digits), number);
+    buffer.append(digits, result.ptr);
+}
+
+void JsonWriter::value(const std::string &text)
+{
+    beginValue();
+    appendString(text);
+}
+
+void JsonWriter::value(bool flag)
+{
+    beginValue();
+    buffer += flag ? "true" : "false";
+}
+
+void JsonWriter::appendNumber(double number)
+{
+    if (!std::isfinite(number))
+    {
+        buffer += "null"; // JSON has no NaN or infinity
+        return;
+    }
+    char digits[32];
+    std::to_chars_result result = std::to_chars(digits, digits + sizeof(digits), number);
+    buffer.append(digits, result.ptr);
+}
+
+void JsonWriter::appendNumber(float number)
+{
+    if (!std::isfinite(number))
+    {
+        buffer += "null";
+        return;
+    }
+    char digits[32];
+    std::to_chars_result result = std::to_chars(digits, digits + sizeof(digits), number);
+    buffer.append(digits, result.ptr);
+}
+
+void JsonWriter::appendString(const std::string &text)
+{
+    static const char HEX_DIGITS[] = "0123456789abcdef";
+    buffer += '"';
+    for (char c : text)
+    {
+        switch (c)
+        {
+        case '"':
+            buffer += "\\\"";
+            break;
+        case '\\':
+            buffer += "\\\\";
+            break;
+        case '\n':
+            buffer += "\\n";
+            break;
+        case '\r':
+            buffer += "\\r";
+            break;
+        case '\t':
+            buffer += "\\t";
+            break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20)
+            {
+                buffer += "\\u00";
+                buffer += HEX_DIGITS[(c >> 4) & 0xf];
+                buffer += HEX_DIGITS[c & 0xf];
+            }
+            else
+            {
+                buffer += c;
+            }
+        }
+    }
+    buffer += '"';
+}
@@ -0,0 +1,156 @@
+#include "../include/ListModeSpectra.h"
+#include "../include/ErrorHandle.h"
+#include <ROOT/TTreeProcessorMT.hxx>
+#include <TTreeReader.h>
+#include <TTreeReaderValue.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+namespace
+{
+    const char *DOMAIN_BRANCH = "domain";
+    const char *CHANNEL_BRANCH = "channel";
+}
+
+ListModeSpectra::ListModeSpectra()
+    : numberOfColumns(0), numberOfChannels(0)
+{
+}
+
+void ListModeSpectra::clear()
+{
+    std::vector<float>().swap(values);
+    slots.clear();
+    numberOfColumns = 0;
+    numberOfChannels = 0;
+}
+
+std::unique_ptr<std::vector<uint32_t>> ListModeSpectra::acquireBuffer(size_t size)
+{
+    std::lock_guard<std::mutex> lock(bufferMutex);
+    if (freeBuffers.empty())
+    {
+        return std::unique_ptr<std::vector<uint32_t>>(new std::vector<uint32_t>(size, 0));
+    }
+    std::unique_ptr<std::vector<uint32_t>> buffer = std::move(freeBuffers.back());
+    freeBuffers.pop_back();
+    return buffer;
+}
+
+void ListModeSpectra::releaseBuffer(std::unique_ptr<std::vector<uint32_t>> buffer)
+{
+    std::lock_guard<std::mutex> lock(bufferMutex);
+    freeBuffers.push_back(std::move(buffer));
+}
+
+bool ListModeSpectra::read(const std::string &path, const std::string &treeName, const std::vector<int> &domains,
+                           int channels, int numberOfThreads)
+{
+    clear();
+    if (domains.empty() || channels <= 0)
+    {
+        ErrorHandle::getInstance().logStatus("List mode: no LUT domains or channels to fill.");
+        return false;
+    }
+    numberOfChannels = channels;
+    numberOfColumns = *std::max_element(domains.begin(), domains.end()) + 1;
+    slots.assign(numberOfColumns + 2, -1);
+    int numberOfDetectors = 0;
+    for (int domain : domains)
+    {
+        if (domain >= 0 && slots[domain] < 0)
+        {
+            slots[domain] = numberOfDetectors++;
+        }
+    }
+    size_t columnSize = getColumnSize();
+    size_t bufferSize = static_cast<size_t>(numberOfDetectors) * columnSize;
+
+    // Every task counts one cluster of entries into a buffer of its own, no locking per hit
+    std::atomic<long long> acceptedHits(0);
+    std::atomic<long long> skippedHits(0);
+    std::atomic<bool> branchesValid(true);
+    auto readStart = std::chrono::steady_clock::now();
+    try
+    {
+        ROOT::TTreeProcessorMT processor(path, treeName, numberOfThreads);
+        processor.Process([&](TTreeReader &reader)
+                          {
+            TTreeReaderValue<int> domain(reader, DOMAIN_BRANCH);
+            TTreeReaderValue<int> channel(reader, CHANNEL_BRANCH);
+            std::unique_ptr<std::vector<uint32_t>> counts = acquireBuffer(bufferSize);
+            long long accepted = 0;
+            long long skipped = 0;
+            while (reader.Next())
+            {
+                int column = *domain;
+                int slot = column >= 0 && column < static_cast<int>(slots.size()) ? slots[column] : -1;
+                if (slot < 0)
+                {
+                    ++skipped; // the channel of a detector outside the LUT is never read
+                    continue;
+                }
+                int bin = std::min(std::max(*channel + 1, 0), numberOfChannels + 1);
+                ++(*counts)[slot * columnSize + bin];
+                ++accepted;
+            }
+            if (domain.GetSetupStatus() < 0 || channel.GetSetupStatus() < 0)
+            {
+                branchesValid = false;
+            }
+            acceptedHits += accepted;
+            skippedHits += skipped;
+            releaseBuffer(std::move(counts)); });
+    }
+    catch (const std::exception &exception)
+    {
+        ErrorHandle::getInstance().logStatus("List mode: could not read tree " + treeName + " of " + path + ": " + exception.what());
+        branchesValid = false;
+    }
+
+    // The buffers of all tasks are summed into the spectra
+    std::vector<std::unique_ptr<std::vector<uint32_t>>> buffers;
+    buffers.swap(freeBuffers);
+    if (!branchesValid)
+    {
+        ErrorHandle::getInstance().logStatus(std::string("List mode: tree ") + treeName + " needs the Int_t branches " +
+                                             DOMAIN_BRANCH + " and " + CHANNEL_BRANCH + ".");
+        clear();
+        return false;
+    }
+    values.assign(bufferSize, 0.0f);
+    for (const auto &buffer : buffers)
+    {
+        for (size_t i = 0; i < bufferSize; ++i)
+        {
+            values[i] += (*buffer)[i];
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - readStart).count();
+    ErrorHandle::getInstance().logStatus("List mode: " + std::to_string(acceptedHits) + " hits of " +
+                                         std::to_string(numberOfDetectors) + " LUT detectors filled, " +
+                                         std::to_string(skippedHits) + " hits of other domains skipped, " +
+                                         std::to_string(buffers.size()) + " task buffers, " + std::to_string(seconds) + " s.");
+    return true;
+}
+
+int ListModeSpectra::getSlot(int column) const
+{
+    return column >= 0 && column < static_cast<int>(slots.size()) ? slots[column] : -1;
+}
+
+const float *ListModeSpectra::getColumn(int column) const
+{
+    int slot = getSlot(column);
+    return slot < 0 ? nullptr : values.data() + static_cast<size_t>(slot) * getColumnSize();
+}
+
+std::unique_ptr<TH2F> ListModeSpectra::createEmptyHistogram(const std::string &name) const
+{
+    std::unique_ptr<TH2F> histogram(new TH2F(name.c_str(), name.c_str(), numberOfColumns, 0, numberOfColumns,
+                                             numberOfChannels, getChannelMin(), getChannelMax()));
+    histogram->SetDirectory(nullptr);
+    return histogram;
+}
@@ -1,12 +1,63 @@
 #include "../include/TaskHandler.h"
+#include "../include/ShardRunner.h"
+#include "../include/ErrorHandle.h"
+#include "../include/RawSpectraFile.h"
 int main(int argc, char *argv[])
 {
     gErrorIgnoreLevel = kError; // sa scap de asta
 
     ArgumentsManager argumentsManager(argc, argv);
     argumentsManager.parseJsonFile();
-    TaskHandler taskHandler(argumentsManager);
-    taskHandler.executeHistogramProcessingTask();
-    std::cerr << "0" << std::endl;
-    return 0;
+    bool succeeded = false;
+    // Watch and batch (-runs / -jobs) modes run every job in this process, sharding is not combined with them
+    if (!argumentsManager.getRawConversionPath().empty())
+    {
+        FileManager fileManager(argumentsManager.getHistogramFilePath(), argumentsManager.getSavePath(),
+                                argumentsManager.getHistogramName(), 0);
+        ErrorHandle::getInstance().setUserInterfaceActive(false);
+        if (fileManager.openFiles())
+        {
+            if (TH2F *histogram = fileManager.getTH2Histogram())
+            {
+                succeeded = RawSpectraFile::writeFromHistogram(*histogram, argumentsManager.getRawConversionPath());
+            }
+        }
+        fileManager.closeFiles();
+    }
+    else if (argumentsManager.isCompressionBenchmark())
+    {
+        FileManager fileManager(argumentsManager.getHistogramFilePath(), argumentsManager.getSavePath(),
+                                argumentsManager.getHistogramName(), 0);
+        ErrorHandle::getInstance().setUserInterfaceActive(false);
+        succeeded = fileManager.openFiles() && fileManager.getTH2Histogram() != nullptr;
+        if (succeeded)
+            fileManager.benchmarkCompression();
+        fileManager.closeFiles();
+    }
+    else if (argumentsManager.isWatchMode() && !argumentsManager.isUserInterfaceEnabled())
+    {
+        TaskHandler taskHandler(argumentsManager);
+        succeeded = taskHandler.executeWatchTask();
+    }
+    else if (!argumentsManager.getBatchJobs().empty() && !argumentsManager.isUserInterfaceEnabled())
+    {
+        TaskHandler taskHandler(argumentsManager);
+        succeeded = taskHandler.executeBatchTask();
+    }
+    // Shards run without the User Interface, they are started again with -s
+    else if (argumentsManager.isShardMergeOnly() ||
+        (argumentsManager.getNumberOfShards() > 1 && !argumentsManager.isUserInterfaceEnabled()))
+    {
+        ShardRunner shardRunner(argumentsManager, argc, argv);
+        succeeded = shardRunner.run();
+    }
+    else
+    {
+        TaskHandler taskHandler(argumentsManager);
+        succeeded = taskHandler.executeHistogramProcessingTask();
+    }
+    // Non-zero when the run failed, ShardRunner relies on it to detect failed shards
+    int exitCode = succeeded ? 0 : 1;
+    std::cerr << exitCode << std::endl;
+    return exitCode;
 }
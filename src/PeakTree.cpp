@@ -0,0 +1,106 @@
+#include "../include/PeakTree.h"
+#include "../include/ErrorHandle.h"
+#include <memory>
+
+PeakTree::PeakTree()
+    : file(nullptr), tree(nullptr), run(0), domain(0), detType(0), energy(0), position(0), sigma(0), area(0),
+      areaError(0), resolution(0), PT(0)
+{
+}
+
+bool PeakTree::create(TFile *outputFile, int runNumber)
+{
+    file = outputFile;
+    tree = nullptr;
+    if (!file || file->IsZombie())
+    {
+        return false;
+    }
+    run = runNumber;
+    file->cd();
+    tree = new TTree("peaks", "Fitted peaks, one row per peak");
+    tree->SetDirectory(file);
+    tree->Branch("run", &run);
+    tree->Branch("domain", &domain);
+    tree->Branch("serial", &serial);
+    tree->Branch("detType", &detType);
+    tree->Branch("energy", &energy);
+    tree->Branch("position", &position);
+    tree->Branch("sigma", &sigma);
+    tree->Branch("area", &area);
+    tree->Branch("areaError", &areaError);
+    tree->Branch("resolution", &resolution);
+    tree->Branch("PT", &PT);
+    return true;
+}
+
+void PeakTree::fill(Histogram &hist, int domainNumber)
+{
+    if (!tree)
+        return;
+    domain = domainNumber;
+    serial = hist.getSerial();
+    detType = hist.getDetType();
+    PT = hist.getPT();
+    for (const Peak &peak : hist.getPeaks())
+    {
+        energy = peak.getAssociatedPosition();
+        position = peak.getPosition();
+        sigma = peak.getSigma();
+        area = peak.getArea();
+        areaError = peak.getAreaError();
+        resolution = peak.calculateResolution();
+        tree->Fill();
+    }
+}
+
+int PeakTree::copyRows(const std::string &previousPath, const std::set<int> &domains)
+{
+    if (!tree)
+        return 0;
+    std::unique_ptr<TFile> previousFile(TFile::Open(previousPath.c_str(), "READ"));
+    TTree *previous = nullptr;
+    if (previousFile && !previousFile->IsZombie())
+    {
+        previousFile->GetObject("peaks", previous);
+    }
+    if (!previous)
+    {
+        ErrorHandle::getInstance().logStatus("Incremental: previous peak tree not found, reused detectors are missing from it.");
+        return 0;
+    }
+
+    // The previous rows are read into the row buffer of this tree, so a copied row is one Fill()
+    std::string *serialPointer = &serial;
+    previous->SetBranchAddress("run", &run);
+    previous->SetBranchAddress("domain", &domain);
+    previous->SetBranchAddress("serial", &serialPointer);
+    previous->SetBranchAddress("detType", &detType);
+    previous->SetBranchAddress("energy", &energy);
+    previous->SetBranchAddress("position", &position);
+    previous->SetBranchAddress("sigma", &sigma);
+    previous->SetBranchAddress("area", &area);
+    previous->SetBranchAddress("areaError", &areaError);
+    previous->SetBranchAddress("resolution", &resolution);
+    previous->SetBranchAddress("PT", &PT);
+    int copied = 0;
+    for (long long entry = 0; entry < previous->GetEntries(); ++entry)
+    {
+        previous->GetEntry(entry);
+        if (domains.count(domain))
+        {
+            tree->Fill();
+            ++copied;
+        }
+    }
+    return copied;
+}
+
+void PeakTree::write()
+{
+    if (!tree)
+        return;
+    file->cd();
+    tree->Write("", TObject::kOverwrite);
+    tree = nullptr;
+}
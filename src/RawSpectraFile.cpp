@@ -0,0 +1,198 @@
+#include "../include/RawSpectraFile.h"
+#include "../include/ColumnMatrix.h"
+#include "../include/ErrorHandle.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+    const char SPECTRA_MAGIC[8] = {'E', 'L', 'I', 'S', 'P', 'E', 'C', '1'};
+    const int CONVERSION_COLUMNS = 64; // columns transposed per block by writeFromHistogram
+
+    size_t getValueSize(uint32_t dtype)
+    {
+        return dtype == RawSpectraFile::FLOAT32 || dtype == RawSpectraFile::UINT32 ? 4 : 0;
+    }
+}
+
+static_assert(sizeof(RawSpectraFile::Header) == 64, "the header layout is part of the file format");
+
+RawSpectraFile::RawSpectraFile()
+    : mapping(nullptr), mappingSize(0), header()
+{
+}
+
+RawSpectraFile::~RawSpectraFile()
+{
+    close();
+}
+
+bool RawSpectraFile::isRawSpectraFile(const std::string &path)
+{
+    char magic[sizeof(SPECTRA_MAGIC)];
+    std::ifstream file(path, std::ios::binary);
+    return file.read(magic, sizeof(magic)) && std::memcmp(magic, SPECTRA_MAGIC, sizeof(magic)) == 0;
+}
+
+bool RawSpectraFile::open(const std::string &filePath)
+{
+    close();
+    path = filePath;
+    int descriptor = ::open(path.c_str(), O_RDONLY);
+    if (descriptor < 0)
+    {
+        ErrorHandle::getInstance().logStatus("Raw spectra: could not open " + path + ": " + strerror(errno));
+        return false;
+    }
+    struct stat fileStatus;
+    if (fstat(descriptor, &fileStatus) != 0 || static_cast<size_t>(fileStatus.st_size) < sizeof(Header))
+    {
+        ::close(descriptor);
+        ErrorHandle::getInstance().logStatus("Raw spectra: " + path + " is too small for a header.");
+        return false;
+    }
+    void *address = mmap(nullptr, fileStatus.st_size, PROT_READ, MAP_SHARED, descriptor, 0);
+    ::close(descriptor); // the mapping keeps the file open
+    if (address == MAP_FAILED)
+    {
+        ErrorHandle::getInstance().logStatus("Raw spectra: could not map " + path + ": " + strerror(errno));
+        return false;
+    }
+    mapping = static_cast<const char *>(address);
+    mappingSize = fileStatus.st_size;
+    std::memcpy(&header, mapping, sizeof(Header));
+
+    // The dimensions are checked before the size of the counts is computed from them, in 64 bits
+    uint64_t valueSize = getValueSize(header.dtype);
+    bool validHeader = std::memcmp(header.magic, SPECTRA_MAGIC, sizeof(SPECTRA_MAGIC)) == 0 && valueSize != 0 &&
+                       header.headerSize >= sizeof(Header) && header.headerSize % valueSize == 0 &&
+                       header.numberOfColumns > 0 && header.numberOfColumns < INT32_MAX - 2 &&
+                       header.numberOfChannels > 0 && header.numberOfChannels < INT32_MAX - 2;
+    if (validHeader)
+    {
+        // Both factors are below 2^31 and valueSize is 4, the product can not overflow 64 bits
+        uint64_t countsSize = (static_cast<uint64_t>(header.numberOfColumns) + 2) *
+                              (static_cast<uint64_t>(header.numberOfChannels) + 2) * valueSize;
+        validHeader = countsSize <= mappingSize && header.headerSize <= mappingSize - countsSize;
+    }
+    if (!validHeader)
+    {
+        ErrorHandle::getInstance().logStatus("Raw spectra: " + path + " has an invalid header or is truncated.");
+        close();
+        return false;
+    }
+    ErrorHandle::getInstance().logStatus("Raw spectra: mapped " + path + ", " + std::to_string(header.numberOfColumns) +
+                                         " columns x " + std::to_string(header.numberOfChannels) + " channels.");
+    return true;
+}
+
+void RawSpectraFile::close()
+{
+    if (mapping)
+    {
+        munmap(const_cast<char *>(mapping), mappingSize);
+        mapping = nullptr;
+        mappingSize = 0;
+    }
+}
+
+const char *RawSpectraFile::getColumnData(int column) const
+{
+    if (!mapping || column < 0 || column > header.numberOfColumns + 1)
+        return nullptr;
+    return mapping + header.headerSize + static_cast<size_t>(column) * getColumnSize() * getValueSize(header.dtype);
+}
+
+const float *RawSpectraFile::getColumn(int column) const
+{
+    return isZeroCopy() ? reinterpret_cast<const float *>(getColumnData(column)) : nullptr;
+}
+
+void RawSpectraFile::copyColumn(int column, float *target) const
+{
+    const char *data = getColumnData(column);
+    if (!data)
+    {
+        std::fill(target, target + getColumnSize(), 0.0f);
+    }
+    else if (isZeroCopy())
+    {
+        std::memcpy(target, data, getColumnSize() * sizeof(float));
+    }
+    else
+    {
+        const uint32_t *counts = reinterpret_cast<const uint32_t *>(data);
+        std::copy(counts, counts + getColumnSize(), target);
+    }
+}
+
+std::unique_ptr<TH2F> RawSpectraFile::createEmptyHistogram(const std::string &name) const
+{
+    std::unique_ptr<TH2F> histogram(new TH2F(name.c_str(), name.c_str(), header.numberOfColumns, header.columnMin,
+                                             header.columnMax, header.numberOfChannels, header.channelMin, header.channelMax));
+    histogram->SetDirectory(nullptr);
+    return histogram;
+}
+
+bool RawSpectraFile::writeFromHistogram(const TH2F &histogram, const std::string &path)
+{
+    if (histogram.GetYaxis()->IsVariableBinSize())
+    {
+        ErrorHandle::getInstance().logStatus("Raw spectra: variable channel bins can not be converted.");
+        return false;
+    }
+    Header fileHeader = {};
+    std::memcpy(fileHeader.magic, SPECTRA_MAGIC, sizeof(SPECTRA_MAGIC));
+    fileHeader.headerSize = sizeof(Header);
+    fileHeader.dtype = FLOAT32;
+    fileHeader.numberOfColumns = histogram.GetNbinsX();
+    fileHeader.numberOfChannels = histogram.GetNbinsY();
+    fileHeader.columnMin = histogram.GetXaxis()->GetXmin();
+    fileHeader.columnMax = histogram.GetXaxis()->GetXmax();
+    fileHeader.channelMin = histogram.GetYaxis()->GetXmin();
+    fileHeader.channelMax = histogram.GetYaxis()->GetXmax();
+
+    // Written next to the target and renamed, a reader never maps a half written file
+    std::string temporaryPath = path + ".tmp";
+    std::ofstream file(temporaryPath, std::ios::binary);
+    if (!file.is_open())
+    {
+        ErrorHandle::getInstance().logStatus("Raw spectra: could not open " + temporaryPath + " for writing.");
+        return false;
+    }
+    file.write(reinterpret_cast<const char *>(&fileHeader), sizeof(Header));
+
+    // The TH2F is x-fastest, a block of columns is transposed at a time
+    int cellsX = fileHeader.numberOfColumns + 2;
+    ColumnMatrix matrix;
+    for (int firstColumn = 0; firstColumn < cellsX; firstColumn += CONVERSION_COLUMNS)
+    {
+        std::vector<int> columns;
+        for (int column = firstColumn; column < std::min(firstColumn + CONVERSION_COLUMNS, cellsX); ++column)
+        {
+            columns.push_back(column);
+        }
+        matrix.load(histogram, columns);
+        for (int column : columns)
+        {
+            ColumnMatrix::Span counts = matrix.getColumn(column);
+            file.write(reinterpret_cast<const char *>(counts.data), counts.size * sizeof(float));
+        }
+    }
+    file.close();
+    if (!file || std::rename(temporaryPath.c_str(), path.c_str()) != 0)
+    {
+        std::remove(temporaryPath.c_str());
+        ErrorHandle::getInstance().logStatus("Raw spectra: could not write " + path);
+        return false;
+    }
+    ErrorHandle::getInstance().logStatus("Raw spectra: wrote " + path);
+    return true;
+}
@@ -0,0 +1,133 @@
+#include "../include/RunManifest.h"
+#include "../include/JsonWriter.h"
+#include <nlohmann/json.hpp>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <limits>
+
+namespace
+{
+    const int MANIFEST_VERSION = 1;
+
+    std::string toHex(uint64_t value)
+    {
+        std::ostringstream stream;
+        stream << std::hex << std::setw(16) << std::setfill('0') << value;
+        return stream.str();
+    }
+
+    uint64_t fromHex(const std::string &text)
+    {
+        return std::stoull(text, nullptr, 16);
+    }
+}
+
+RunManifest::RunManifest() : settingsHash(0)
+{
+}
+
+uint64_t RunManifest::hashBytes(const void *data, size_t size, uint64_t hash)
+{
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL; // FNV-1a prime
+    }
+    return hash;
+}
+
+uint64_t RunManifest::hashString(const std::string &text, uint64_t hash)
+{
+    // The length is hashed too, so ("ab", "c") and ("a", "bc") differ
+    return hashBytes(text.data(), text.size(), hashValue(text.size(), hash));
+}
+
+void RunManifest::clear()
+{
+    settingsHash = 0;
+    entries.clear();
+}
+
+const RunManifest::Entry *RunManifest::findEntry(int domain) const
+{
+    auto it = entries.find(domain);
+    return it != entries.end() ? &it->second : nullptr;
+}
+
+bool RunManifest::writeToFile(const std::string &path) const
+{
+    std::ofstream file(path);
+    if (!file.is_open())
+    {
+        return false;
+    }
+    // Coefficients are written as the shortest round-trip digits, a failed fit (NaN, inf) as null
+    JsonWriter writer;
+    writer.beginObject();
+    writer.key("version");
+    writer.value(MANIFEST_VERSION);
+    writer.key("settings");
+    writer.value(toHex(settingsHash));
+    writer.key("detectors");
+    writer.beginArray();
+    for (const auto &entry : entries)
+    {
+        writer.beginObject(true);
+        writer.key("domain");
+        writer.value(entry.first);
+        writer.key("hash");
+        writer.value(toHex(entry.second.hash));
+        writer.key("pol_list");
+        writer.beginArray();
+        for (double coefficient : entry.second.coefficients)
+        {
+            writer.value(coefficient);
+        }
+        writer.endArray();
+        writer.endObject();
+    }
+    writer.endArray();
+    writer.endObject();
+    file << writer.str() << "\n";
+    return file.good();
+}
+
+bool RunManifest::readFromFile(const std::string &path)
+{
+    clear();
+    std::ifstream file(path);
+    if (!file.is_open())
+    {
+        return false;
+    }
+    try
+    {
+        nlohmann::json jsonData;
+        file >> jsonData;
+        if (!jsonData.contains("version") || jsonData["version"].get<int>() != MANIFEST_VERSION)
+        {
+            return false;
+        }
+        settingsHash = fromHex(jsonData["settings"].get<std::string>());
+        for (const auto &item : jsonData["detectors"])
+        {
+            Entry entry;
+            entry.hash = fromHex(item["hash"].get<std::string>());
+            for (const auto &coefficient : item["pol_list"])
+            {
+                // null is a coefficient that was not finite
+                entry.coefficients.push_back(coefficient.is_number() ? coefficient.get<double>()
+                                                                     : std::numeric_limits<double>::quiet_NaN());
+            }
+            entries[item["domain"].get<int>()] = entry;
+        }
+    }
+    catch (const std::exception &)
+    {
+        clear();
+        return false;
+    }
+    return true;
+}
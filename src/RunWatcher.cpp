@@ -0,0 +1,133 @@
+#include "../include/RunWatcher.h"
+#include "../include/ErrorHandle.h"
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#include <csignal>
+#include <cctype>
+#include <charconv>
+#include <cerrno>
+#include <cstring>
+
+namespace
+{
+    volatile std::sig_atomic_t stopRequested = 0;
+
+    void requestStop(int)
+    {
+        stopRequested = 1;
+    }
+
+    const int POLL_TIMEOUT_MS = 500; // how often a stop request is noticed while idle
+}
+
+RunWatcher::RunWatcher(const std::string &directory)
+    : directory(directory.empty() ? "./" : directory), inotifyDescriptor(-1), watchDescriptor(-1)
+{
+    if (this->directory.back() != '/')
+    {
+        this->directory += '/';
+    }
+}
+
+RunWatcher::~RunWatcher()
+{
+    if (inotifyDescriptor >= 0)
+    {
+        close(inotifyDescriptor); // also removes the watch
+    }
+}
+
+bool RunWatcher::start()
+{
+    inotifyDescriptor = inotify_init1(IN_CLOEXEC);
+    if (inotifyDescriptor < 0)
+    {
+        ErrorHandle::getInstance().logStatus(std::string("Watch: inotify is not available: ") + strerror(errno));
+        return false;
+    }
+    watchDescriptor = inotify_add_watch(inotifyDescriptor, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (watchDescriptor < 0)
+    {
+        ErrorHandle::getInstance().logStatus("Watch: cannot watch " + directory + ": " + strerror(errno));
+        return false;
+    }
+    std::signal(SIGINT, requestStop);
+    std::signal(SIGTERM, requestStop);
+    ErrorHandle::getInstance().logStatus("Watching " + directory + " for new runs.");
+    return true;
+}
+
+void RunWatcher::readEvents()
+{
+    alignas(inotify_event) char buffer[4096];
+    ssize_t length = read(inotifyDescriptor, buffer, sizeof(buffer));
+    for (ssize_t offset = 0; offset < length;)
+    {
+        const inotify_event *event = reinterpret_cast<const inotify_event *>(buffer + offset);
+        offset += sizeof(inotify_event) + event->len;
+        if (event->len == 0 || (event->mask & IN_ISDIR))
+            continue;
+        std::string fileName = event->name;
+        if (findRunNumber(fileName) >= 0)
+        {
+            pendingFiles.push_back(directory + fileName);
+        }
+    }
+}
+
+std::string RunWatcher::waitForRun()
+{
+    while (pendingFiles.empty())
+    {
+        if (stopRequested || inotifyDescriptor < 0)
+        {
+            return "";
+        }
+        pollfd descriptor{inotifyDescriptor, POLLIN, 0};
+        int ready = poll(&descriptor, 1, POLL_TIMEOUT_MS);
+        if (ready > 0)
+        {
+            readEvents();
+        }
+        else if (ready < 0 && errno != EINTR)
+        {
+            ErrorHandle::getInstance().logStatus(std::string("Watch: poll failed: ") + strerror(errno));
+            return "";
+        }
+    }
+    std::string file = pendingFiles.front();
+    pendingFiles.pop_front();
+    return file;
+}
+
+// Same rule as ArgumentsManager::getHistogramFilename: "_<digits>_" in the name and a .root file
+int RunWatcher::findRunNumber(const std::string &fileName)
+{
+    if (fileName.find(".root") == std::string::npos)
+        return -1;
+    size_t pos = 0;
+    while ((pos = fileName.find('_', pos)) != std::string::npos)
+    {
+        size_t start = pos + 1;
+        size_t end = start;
+        while (end < fileName.size() && std::isdigit(static_cast<unsigned char>(fileName[end])))
+        {
+            ++end;
+        }
+        // A number too large for an int is not a run number, the search goes on
+        int runNumber = 0;
+        if (end > start && end < fileName.size() && fileName[end] == '_' &&
+            std::from_chars(fileName.data() + start, fileName.data() + end, runNumber).ec == std::errc())
+        {
+            return runNumber;
+        }
+        pos = start;
+    }
+    return -1;
+}
+
+bool RunWatcher::isStopRequested()
+{
+    return stopRequested != 0;
+}
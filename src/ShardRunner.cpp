@@ -0,0 +1,303 @@
+#include "../include/ShardRunner.h"
+#include "../include/ArgumentsManager.h"
+#include "../include/ErrorHandle.h"
+#include "../include/CalibrationTable.h"
+#include <TFileMerger.h>
+#include <fstream>
+#include <algorithm>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <signal.h>
+
+ShardRunner::ShardRunner(ArgumentsManager &args, int argc, char *argv[])
+    : argumentsManager(args),
+      fileManager(args.getHistogramFilePath(), args.getSavePath(), args.getHistogramName(), 0),
+      numberOfShards(std::max(args.getNumberOfShards(), 1))
+{
+    fileManager.setCompressionProfiles(args.getCompressionProfiles());
+    // Options that are set per shard (or only make sense here) are dropped, everything else is passed on
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "-sh" || arg == "-shards" || arg == "-merge" || arg == "-sp" || arg == "--save_path")
+        {
+            ++i;
+        }
+        else if (arg == "-d" || arg == "-domainLimits")
+        {
+            i += 2;
+        }
+        else
+        {
+            arguments.push_back(arg);
+        }
+    }
+}
+
+bool ShardRunner::run()
+{
+    ErrorHandle::getInstance().setUserInterfaceActive(false);
+    ErrorHandle::getInstance().startProgram();
+    fileManager.openFiles();
+    ErrorHandle::getInstance().setPathForSave(fileManager.getSavePath());
+
+    bool succeeded = true;
+    if (!argumentsManager.isShardMergeOnly())
+    {
+        std::vector<std::pair<int, int>> domains = splitDomains();
+        if (domains.empty())
+        {
+            ErrorHandle::getInstance().logStatus("No domains to process, STOP the Task.");
+            ErrorHandle::getInstance().saveLogFile();
+            return false;
+        }
+        numberOfShards = domains.size();
+        if (!launchShards(domains))
+        {
+            ErrorHandle::getInstance().logStatus("Some shards failed, their domains are missing from the merged outputs.");
+            succeeded = false;
+        }
+    }
+    // The input file is not needed for merging and the merged outputs are written here
+    fileManager.closeFiles();
+    succeeded = mergeShards() && succeeded;
+    ErrorHandle::getInstance().saveLogFile();
+    return succeeded;
+}
+
+std::vector<std::pair<int, int>> ShardRunner::splitDomains() const
+{
+    // Same column range as TaskHandler::process2DHistogram(), both ends included
+    int firstDomain = 0;
+    int lastDomain = 0;
+    if (argumentsManager.isDomainLimitsSet())
+    {
+        firstDomain = argumentsManager.getXminDomain();
+        lastDomain = argumentsManager.getXmaxDomain();
+    }
+    else if (!argumentsManager.getListModeTree().empty())
+    {
+        // The events are read by the shards, each one only fills the spectra of its own domains
+        std::vector<int> lutDomains = argumentsManager.getConfiguredDomains();
+        if (lutDomains.empty())
+        {
+            return {};
+        }
+        lastDomain = lutDomains.back();
+    }
+    else
+    {
+        TH2F *inputTH2 = fileManager.getTH2Histogram();
+        if (!inputTH2)
+        {
+            return {};
+        }
+        lastDomain = inputTH2->GetNbinsX();
+    }
+
+    // Every shard gets the same number of LUT detectors, the other columns are never processed
+    std::vector<int> configuredDomains;
+    for (int domain : argumentsManager.getConfiguredDomains())
+    {
+        if (domain >= firstDomain && domain <= lastDomain)
+        {
+            configuredDomains.push_back(domain);
+        }
+    }
+
+    std::vector<std::pair<int, int>> domains;
+    int numberOfDomains = configuredDomains.size();
+    int shards = std::min(numberOfShards, numberOfDomains);
+    for (int shard = 0; shard < shards; ++shard)
+    {
+        int first = static_cast<long>(numberOfDomains) * shard / shards;
+        int last = static_cast<long>(numberOfDomains) * (shard + 1) / shards - 1;
+        domains.emplace_back(configuredDomains[first], configuredDomains[last]);
+    }
+    return domains;
+}
+
+std::string ShardRunner::getShardDirectory(int shard) const
+{
+    return fileManager.getSavePath() + "shard_" + std::to_string(shard) + "/";
+}
+
+std::string ShardRunner::getShardFilePath(int shard, const std::string &suffix) const
+{
+    return getShardDirectory(shard) + fileManager.getRunName() + suffix;
+}
+
+bool ShardRunner::launchShards(const std::vector<std::pair<int, int>> &domains)
+{
+    std::vector<pid_t> processes;
+    for (int shard = 0; shard < static_cast<int>(domains.size()); ++shard)
+    {
+        // Shard options go first, -s consumes the rest of the command line
+        std::vector<std::string> shardArguments = {"task",
+                                                   "-d", std::to_string(domains[shard].first), std::to_string(domains[shard].second),
+                                                   "-sp", getShardDirectory(shard)};
+        shardArguments.insert(shardArguments.end(), arguments.begin(), arguments.end());
+        std::vector<char *> argv;
+        for (std::string &argument : shardArguments)
+        {
+            argv.push_back(&argument[0]);
+        }
+        argv.push_back(nullptr);
+
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            execv("/proc/self/exe", argv.data());
+            _exit(127);
+        }
+        if (pid < 0)
+        {
+            ErrorHandle::getInstance().logStatus("Error: Could not start shard " + std::to_string(shard) + ".");
+        }
+        else
+        {
+            ErrorHandle::getInstance().logStatus("Shard " + std::to_string(shard) + " (domains " + std::to_string(domains[shard].first) + " - " + std::to_string(domains[shard].second) + ") started, pid " + std::to_string(pid) + ".");
+        }
+        processes.push_back(pid);
+    }
+
+    bool allSucceeded = true;
+    for (int shard = 0; shard < static_cast<int>(processes.size()); ++shard)
+    {
+        int status = 0;
+        if (processes[shard] < 0 || waitpid(processes[shard], &status, 0) < 0)
+        {
+            failedShards.insert(shard);
+            allSucceeded = false;
+            continue;
+        }
+        std::string shardName = "Shard " + std::to_string(shard) + " (domains " + std::to_string(domains[shard].first) + " - " + std::to_string(domains[shard].second) + ")";
+        if (WIFSIGNALED(status))
+        {
+            ErrorHandle::getInstance().logStatus(shardName + " crashed with signal " + std::to_string(WTERMSIG(status)) + ".");
+            failedShards.insert(shard);
+            allSucceeded = false;
+        }
+        else if (WEXITSTATUS(status) != 0)
+        {
+            ErrorHandle::getInstance().logStatus(shardName + " exited with code " + std::to_string(WEXITSTATUS(status)) + ".");
+            failedShards.insert(shard);
+            allSucceeded = false;
+        }
+        else
+        {
+            ErrorHandle::getInstance().logStatus(shardName + " finished.");
+        }
+    }
+    return allSucceeded;
+}
+
+bool ShardRunner::mergeShards()
+{
+    int outputs = argumentsManager.getOutputSinks();
+    bool merged = true;
+    if (outputs & FileManager::JSON_PEAKS)
+        merged = mergeJsonFiles("_peaks_data.json") && merged;
+    if (outputs & FileManager::ROOT_PEAKS)
+        merged = mergeRootFiles("_peaks.root", FileManager::ROOT_PEAKS) && merged;
+    if (outputs & FileManager::ROOT_CALIBRATED)
+        merged = mergeRootFiles("_calibrated_histograms.root", FileManager::ROOT_CALIBRATED) && merged;
+    if (outputs & FileManager::ROOT_COMBINED)
+        merged = mergeRootFiles("_combinedHistogram.root", FileManager::ROOT_COMBINED) && merged;
+    if (outputs & FileManager::ROOT_GAMMA_GAMMA)
+        merged = mergeRootFiles("_calibrated_gammaGamma.root", FileManager::ROOT_GAMMA_GAMMA) && merged;
+    if (outputs & FileManager::ROOT_PEAK_TREE)
+        merged = mergeRootFiles("_peak_tree.root", FileManager::ROOT_PEAK_TREE) && merged;
+    if (outputs & FileManager::CALIBRATION_TABLE)
+        merged = mergeCalibrationTables("_calibration_table.bin") && merged;
+    return merged;
+}
+
+bool ShardRunner::isMerged(int shard, const std::string &path) const
+{
+    if (failedShards.count(shard) != 0)
+    {
+        ErrorHandle::getInstance().logStatus("Failed shard output not merged: " + path);
+        return false;
+    }
+    struct stat fileStatus;
+    if (stat(path.c_str(), &fileStatus) != 0)
+    {
+        ErrorHandle::getInstance().logStatus("Missing shard output: " + path);
+        return false;
+    }
+    return true;
+}
+
+bool ShardRunner::mergeJsonFiles(const std::string &suffix)
+{
+    // Every shard writes a complete array, the merged one holds all records in domain order
+    std::map<int, std::string> records;
+    for (int shard = 0; shard < numberOfShards; ++shard)
+    {
+        if (!isMerged(shard, getShardFilePath(shard, suffix)))
+            continue;
+        std::map<int, std::string> shardRecords = FileManager::readJsonRecords(getShardFilePath(shard, suffix));
+        records.insert(shardRecords.begin(), shardRecords.end());
+    }
+    std::string target = fileManager.getOutputFilePath(suffix);
+    if (!FileManager::writeJsonRecords(target, records))
+    {
+        return false;
+    }
+    ErrorHandle::getInstance().logStatus("Merged shard outputs into: " + target);
+    return true;
+}
+
+bool ShardRunner::mergeRootFiles(const std::string &suffix, FileManager::OutputFile output)
+{
+    std::string target = fileManager.getOutputFilePath(suffix);
+    TFileMerger merger(false);
+    if (!merger.OutputFile(target.c_str(), true, fileManager.getCompressionSettings(output)))
+    {
+        ErrorHandle::getInstance().logStatus("Error: Could not open merged file for writing. " + target);
+        return false;
+    }
+    int numberOfInputs = 0;
+    for (int shard = 0; shard < numberOfShards; ++shard)
+    {
+        std::string path = getShardFilePath(shard, suffix);
+        if (!isMerged(shard, path))
+            continue;
+        if (!merger.AddFile(path.c_str(), false))
+        {
+            ErrorHandle::getInstance().logStatus("Error: Could not read shard output: " + path);
+            continue;
+        }
+        numberOfInputs++;
+    }
+    // Histograms with the same name (the partial combined TH2) are added, the others are copied
+    if (numberOfInputs == 0 || !merger.Merge())
+    {
+        ErrorHandle::getInstance().logStatus("Error: Could not merge shard outputs into: " + target);
+        return false;
+    }
+    ErrorHandle::getInstance().logStatus("Merged " + std::to_string(numberOfInputs) + " shard outputs into: " + target);
+    return true;
+}
+
+bool ShardRunner::mergeCalibrationTables(const std::string &suffix)
+{
+    CalibrationTable table;
+    for (int shard = 0; shard < numberOfShards; ++shard)
+    {
+        if (isMerged(shard, getShardFilePath(shard, suffix)) && !table.readFromFile(getShardFilePath(shard, suffix), true))
+        {
+            ErrorHandle::getInstance().logStatus("Missing shard output: " + getShardFilePath(shard, suffix));
+        }
+    }
+    std::string target = fileManager.getOutputFilePath(suffix);
+    if (!table.writeToFile(target))
+    {
+        ErrorHandle::getInstance().logStatus("Error: Could not write calibration table: " + target);
+        return false;
+    }
+    ErrorHandle::getInstance().logStatus("Merged calibration table with " + std::to_string(table.getNumberOfDetectors()) + " detectors saved in: " + target);
+    return true;
+}
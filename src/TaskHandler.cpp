@@ -1,11 +1,46 @@
 #include "TaskHandler.h"
 #include "../include/ErrorHandle.h"
+#include "../include/RunWatcher.h"
 #include <TError.h>
+#include <TKey.h>
+#include <TROOT.h>
+#include <Math/MinimizerOptions.h>
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <set>
+#include <fstream>
+#include <cstdlib>
+
+const int COLUMNS_PER_WORKER = 4;         // columns per pipeline batch and fit worker
+const size_t PIPELINE_QUEUE_DEPTH = 2;    // batches waiting for the output writer
+const size_t PIPELINE_BATCHES_IN_FLIGHT = 4; // batches extracted and not yet handed to the output writer
+const size_t COLUMNS_PER_CHUNK = 64;      // columns copied out of the TH2 at a time by the serial loop
 
 TaskHandler::TaskHandler(ArgumentsManager &args)
     : argumentsManager(args), inputTH2(nullptr), energyArray(nullptr), size(0),
-      fileManager(args.getHistogramFilePath(), args.getSavePath(), args.getHistogramName())
+      fileManager(args.getHistogramFilePath(), args.getSavePath(), args.getHistogramName(),
+                  args.getOutputSinks())
 {
+    fileManager.setKeepPreviousOutputs(args.isIncrementalRun());
+    fileManager.setCompressionProfiles(args.getCompressionProfiles());
+    if (!args.getListModeTree().empty())
+    {
+        // Only the spectra of the LUT detectors in the domain range are filled from the events
+        std::vector<int> domains;
+        for (int domain : args.getConfiguredDomains())
+        {
+            if (!args.isDomainLimitsSet() || (domain >= args.getXminDomain() && domain <= args.getXmaxDomain()))
+            {
+                domains.push_back(domain);
+            }
+        }
+        int threads = args.isUserInterfaceEnabled() ? 1 : args.getNumberOfWorkers();
+        fileManager.setListModeInput(args.getListModeTree(), args.getListModeChannels(), domains, threads);
+    }
 }
 
 TaskHandler::~TaskHandler()
@@ -16,29 +51,197 @@ TaskHandler::~TaskHandler()
     }
 }
 
-void TaskHandler::executeHistogramProcessingTask()
+bool TaskHandler::executeHistogramProcessingTask()
 {
     ErrorHandle::getInstance().setUserInterfaceActive(argumentsManager.isUserInterfaceEnabled());
     ErrorHandle::getInstance().startProgram();
-    fileManager.openFiles();
+    bool opened = fileManager.openFiles();
     ErrorHandle::getInstance().setPathForSave(fileManager.getSavePath());
     energyArray = initializeEnergyArray();
     if(energyArray == nullptr)
     {
         ErrorHandle::getInstance().logStatus("Energy array is null STOP the Task.");
         ErrorHandle::getInstance().saveLogFile();
-        return;
+        return false;
     }
-    if (fileManager.getTH2Histogram() == nullptr)
+    if (!opened || fileManager.getTH2Histogram() == nullptr)
     {
-        ErrorHandle::getInstance().logStatus("TH2F histogram is null STOP the Task.");
+        ErrorHandle::getInstance().logStatus("Input or output files could not be opened or TH2F histogram is null STOP the Task.");
         ErrorHandle::getInstance().saveLogFile();
-        return;
+        return false;
     }
+    configureParallelProcessing();
+    openCalibrationCache();
     process2DHistogram();
 
     fileManager.closeFiles();
     ErrorHandle::getInstance().saveLogFile();
+    return true;
+}
+
+bool TaskHandler::prepareSharedSetup()
+{
+    // Sources, LUT, energy array and fit workers are set up once and reused by every run
+    ErrorHandle::getInstance().setUserInterfaceActive(false);
+    ErrorHandle::getInstance().startProgram();
+    energyArray = initializeEnergyArray();
+    if (energyArray == nullptr)
+    {
+        ErrorHandle::getInstance().logStatus("Energy array is null STOP the Task.");
+        ErrorHandle::getInstance().saveLogFile();
+        return false;
+    }
+    configureParallelProcessing();
+    openCalibrationCache();
+    return true;
+}
+
+bool TaskHandler::processRun(const std::string &histogramFilePath, const std::string &savePath)
+{
+    // Reset first, the status of a run that fails to open must not show the previous run's detectors
+    resetRunState();
+    fileManager.setInput(histogramFilePath, savePath.empty() ? argumentsManager.getSavePath() : savePath);
+    bool opened = fileManager.openFiles();
+    ErrorHandle::getInstance().setPathForSave(fileManager.getSavePath());
+    // The TH2 is read once here, process2DHistogram() gets the same object from the FileManager
+    inputTH2 = opened ? fileManager.getTH2Histogram() : nullptr;
+    bool processed = inputTH2 != nullptr;
+    if (!processed)
+    {
+        ErrorHandle::getInstance().logStatus("Files could not be opened or TH2F histogram is null, run skipped.");
+    }
+    else
+    {
+        process2DHistogram();
+    }
+    fileManager.closeFiles();
+    // Every run keeps its own error_log.json next to its outputs
+    ErrorHandle::getInstance().saveLogFile();
+    return processed;
+}
+
+bool TaskHandler::executeBatchTask()
+{
+    if (!prepareSharedSetup())
+        return false;
+
+    // A failed run does not stop the batch, it only makes the result false
+    bool allProcessed = true;
+    const std::vector<ArgumentsManager::RunJob> &jobs = argumentsManager.getBatchJobs();
+    for (size_t job = 0; job < jobs.size(); ++job)
+    {
+        ErrorHandle::getInstance().logStatus("Batch run " + std::to_string(job + 1) + "/" + std::to_string(jobs.size()) +
+                                             ": " + jobs[job].histogramFilePath);
+        allProcessed = processRun(jobs[job].histogramFilePath, jobs[job].savePath) && allProcessed;
+        ErrorHandle::getInstance().clearLog();
+    }
+    return allProcessed;
+}
+
+bool TaskHandler::executeWatchTask()
+{
+    RunWatcher watcher(argumentsManager.getWatchDirectory());
+    if (!prepareSharedSetup() || !watcher.start())
+    {
+        ErrorHandle::getInstance().saveLogFile();
+        return false;
+    }
+    ErrorHandle::getInstance().saveLogFile();
+    ErrorHandle::getInstance().clearLog();
+
+    for (std::string file = watcher.waitForRun(); !file.empty(); file = watcher.waitForRun())
+    {
+        ErrorHandle::getInstance().logStatus("Watch: new run file " + file);
+        auto start = std::chrono::steady_clock::now();
+        bool processed = processRun(file, "");
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        writeRunStatus(file, processed, seconds);
+        ErrorHandle::getInstance().clearLog();
+    }
+    ErrorHandle::getInstance().logStatus("Watch stopped.");
+    return true;
+}
+
+void TaskHandler::writeRunStatus(const std::string &histogramFilePath, bool processed, double seconds)
+{
+    // One small record per run next to its outputs, e.g. for the shift crew or a monitoring script.
+    // A run that could not be opened has no save path, its record goes next to the watched file.
+    std::string runName = fileManager.getRunName();
+    std::string statusPath;
+    if (!runName.empty())
+    {
+        statusPath = fileManager.getOutputFilePath("_status.json");
+    }
+    else
+    {
+        size_t extension = histogramFilePath.rfind(".root");
+        statusPath = histogramFilePath.substr(0, extension) + "_status.json";
+        size_t nameStart = histogramFilePath.find_last_of('/');
+        int runNumber = RunWatcher::findRunNumber(histogramFilePath.substr(nameStart == std::string::npos ? 0 : nameStart + 1));
+        runName = runNumber >= 0 ? std::to_string(runNumber) : "";
+    }
+    std::ofstream statusFile(statusPath);
+    if (!statusFile.is_open())
+    {
+        ErrorHandle::getInstance().logStatus("Watch: could not write the status of " + histogramFilePath);
+        return;
+    }
+    int errors = ErrorHandle::getInstance().getNumberOfErrors();
+    JsonWriter status("  ");
+    status.beginObject();
+    status.key("run");
+    status.value(runName);
+    status.key("input");
+    status.value(histogramFilePath);
+    status.key("status");
+    status.value(!processed ? "failed" : (errors > 0 ? "done_with_errors" : "done"));
+    status.key("plannedDetectors");
+    status.value(static_cast<int64_t>(processingPlan.size()));
+    status.key("calibratedDetectors");
+    status.value(static_cast<int64_t>(detectorCoefficients.size()));
+    status.key("errors");
+    status.value(errors);
+    status.key("seconds");
+    status.value(seconds);
+    status.endObject();
+    statusFile << status.str() << "\n";
+}
+
+void TaskHandler::openCalibrationCache()
+{
+    if (argumentsManager.getCacheDirectory().empty())
+        return;
+    calibrationCache.reset(new CalibrationCache(argumentsManager.getCacheDirectory(),
+                                                static_cast<uint64_t>(argumentsManager.getCacheSizeMB()) << 20));
+    if (!calibrationCache->open())
+    {
+        calibrationCache.reset();
+    }
+}
+
+void TaskHandler::logCacheUsage() const
+{
+    if (calibrationCache)
+    {
+        ErrorHandle::getInstance().logStatus("Calibration cache: " + std::to_string(calibrationCache->getHits()) + " hits, " +
+                                             std::to_string(calibrationCache->getMisses()) + " misses so far, " +
+                                             std::to_string(calibrationCache->getTotalBytes() >> 10) + " KiB used.");
+    }
+}
+
+void TaskHandler::resetRunState()
+{
+    inputTH2 = nullptr;
+    histograms.clear();
+    detectorCoefficients.clear();
+    processingPlan.clear();
+    columnStatistics.clear();
+    calibratedColumnsDone.clear();
+    columnMatrix.release();
+    calibrationTable = CalibrationTable();
+    manifest.clear();
+    columnHashes.clear();
+    reusedColumns.clear();
 }
 
 double *TaskHandler::initializeEnergyArray()
@@ -79,101 +282,846 @@ void TaskHandler::process2DHistogram()
         start_column = argumentsManager.getXminDomain();
         number_of_columns = argumentsManager.getXmaxDomain();
     }
-    for (int column = start_column; column <= number_of_columns; ++column)
+
+    // Only the detectors of the LUT are looked at; one pass over their TH2 columns drops the dead ones.
+    // The rest is streamed: a few columns at a time are copied out, fitted, written and released.
+    buildProcessingPlan(start_column, number_of_columns);
+    hashPlannedColumns();
+    journal.open(fileManager.getOutputFilePath("_journal.bin"), manifest.getSettingsHash(), argumentsManager.isResumeRun());
+    if (argumentsManager.isIncrementalRun())
     {
-        TH1D *hist1D = inputTH2->ProjectionY(Form("hist1D_col%d", column), column, column);
-        if (hist1D)
+        planIncrementalRun();
+    }
+
+    // Calibrated spectra replace their raw column in the input TH2 once it has been copied out,
+    // the TH2 becomes the combined histogram without a second matrix in memory
+    if (fileManager.isOutputEnabled(FileManager::ROOT_COMBINED))
+    {
+        calibratedColumnsDone.assign(inputTH2->GetNbinsX() + 2, 0);
+    }
+    if (fileManager.isOutputEnabled(FileManager::ROOT_PEAK_TREE))
+    {
+        peakTree.create(fileManager.getOutputFilePeakTree(), std::atoi(fileManager.getRunName().c_str()));
+    }
+    if (fileManager.isOutputEnabled(FileManager::CALIBRATION_TABLE))
+    {
+        const TAxis *channelAxis = inputTH2->GetYaxis();
+        int firstChannel = static_cast<int>(channelAxis->GetXmin());
+        int numberOfChannels = static_cast<int>(std::ceil(channelAxis->GetXmax())) - firstChannel;
+        calibrationTable = CalibrationTable(numberOfChannels, firstChannel);
+    }
+
+    if (workerPool)
+    {
+        // Outputs are written in the background from here on, ROOT is thread-safe with the worker pool
+        fileManager.startOutputWriter(PIPELINE_QUEUE_DEPTH);
+        processColumnsInPipeline();
+    }
+    else
+    {
+        for (size_t chunkFirstJob = 0; chunkFirstJob < processingPlan.size(); chunkFirstJob += COLUMNS_PER_CHUNK)
         {
-            processSingleHistogram(hist1D);
+            size_t chunkEndJob = std::min(chunkFirstJob + COLUMNS_PER_CHUNK, processingPlan.size());
+            loadColumnMatrix(chunkFirstJob, chunkEndJob);
+            for (size_t job = chunkFirstJob; job < chunkEndJob; ++job)
+            {
+                int column = processingPlan[job];
+                processSingleHistogram(columnMatrix.createHistogram(column, Form("hist1D_col%d", column)), column);
+            }
         }
     }
-    combineHistogramsIntoTH2();
+    columnMatrix.release();
+    if (!reusedColumns.empty())
+    {
+        // The previous outputs are merged into files the writer may still be writing to
+        fileManager.finishOutputWriter();
+        spliceReusedDetectors();
+        if (workerPool)
+        {
+            fileManager.startOutputWriter(PIPELINE_QUEUE_DEPTH);
+        }
+    }
+    if (fileManager.isOutputEnabled(FileManager::ROOT_COMBINED))
+    {
+        combineHistogramsIntoTH2();
+    }
+    if (fileManager.isOutputEnabled(FileManager::CALIBRATION_TABLE))
+    {
+        saveCalibrationTable();
+    }
+    if (fileManager.isOutputEnabled(FileManager::ROOT_GAMMA_GAMMA))
+    {
+        calibrateGammaGammaMatrices();
+    }
+    fileManager.finishOutputWriter();
+    peakTree.write();
+    logCacheUsage();
+    if (!manifest.writeToFile(fileManager.getOutputFilePath("_manifest.json")))
+    {
+        ErrorHandle::getInstance().logStatus("Error: Could not write the run manifest.");
+    }
+    // Every output is written, nothing is left to resume
+    journal.remove();
 
     if (argumentsManager.isUserInterfaceEnabled())
     {
-        ui.askAboutPeaks(histograms, fileManager.getJsonFile(), fileManager.getOutputFileHistograms(), fileManager.getOutputFileCalibrated());
+        ui.askAboutPeaks(histograms, fileManager);
     }
     // The part where UI asks if you want to change a peak
 }
 
-void TaskHandler::processSingleHistogram(TH1D *const hist1D)
+void TaskHandler::buildProcessingPlan(int firstColumn, int lastColumn)
 {
-    if (!hist1D || hist1D->GetMean() < 5)
+    processingPlan.clear();
+    if (!argumentsManager.checkIfRunIsValid())
     {
-        delete hist1D;
-        histograms.emplace_back();
-        // if you want to check
-        // ErrorHandle::getInstance().logStatus(std::string("The mean for the histogram ") + std::to_string(histograms.size()) + " is less than 5. ");
+        ErrorHandle::getInstance().logStatus("No Lut File, no histogram is processed.");
         return;
     }
 
-    Histogram hist;
-    int histIndex = argumentsManager.getNumberColumnSpecified(histograms.size());
-    if (argumentsManager.checkIfRunIsValid() && histIndex != -1)
+    std::vector<int> configuredColumns;
+    for (int domain : argumentsManager.getConfiguredDomains())
+    {
+        if (domain < firstColumn || domain > lastColumn)
+            continue;
+        if (domain > inputTH2->GetNbinsX() + 1)
+        {
+            ErrorHandle::getInstance().logStatus(std::string("Histogram: ") + std::to_string(domain) + " from the Lut File is not in the TH2.");
+            continue;
+        }
+        configuredColumns.push_back(domain);
+    }
+
+    // Same rule as the mean of the column spectrum, decided from the preflight statistics
+    if (const RawSpectraFile *spectra = fileManager.getRawSpectra())
+    {
+        columnStatistics = ColumnStatistics::collect(*spectra, configuredColumns);
+    }
+    else if (const ListModeSpectra *spectra = fileManager.getListModeSpectra())
     {
-        ErrorHandle::getInstance().logStatus(std::string("Histogram: ") + std::to_string(histograms.size()) + " start to be processed.");
-        ErrorHandle::getInstance().logStatus("start------------------------------------------------.");
-        hist = Histogram(
-            argumentsManager.getXminFile(histIndex), argumentsManager.getXmaxFile(histIndex),
-            argumentsManager.getFWHMmaxFile(histIndex), argumentsManager.getMinAmplitudeFile(histIndex),
-            argumentsManager.getMaxAmplitude(), argumentsManager.getSerialFile(histIndex),
-            argumentsManager.getDetTypeFile(histIndex), argumentsManager.getPolynomialFitThreshold(),
-            argumentsManager.getNumberOfPeaks(), hist1D,
-            argumentsManager.getHistogramNameFile(histIndex), argumentsManager.getSourcesName());
+        columnStatistics = ColumnStatistics::collect(*spectra, configuredColumns);
     }
     else
     {
-        delete hist1D;
-        histograms.emplace_back();
-        ErrorHandle::getInstance().logStatus(std::string("Histogram: ") + std::to_string(histograms.size()) + " is not in the Lut FIle.");
+        columnStatistics = ColumnStatistics::collect(*inputTH2, configuredColumns);
+    }
+    for (int column : configuredColumns)
+    {
+        if (columnStatistics[column].mean >= 5)
+        {
+            processingPlan.push_back(column);
+        }
+        // if you want to check
+        // else ErrorHandle::getInstance().logStatus(std::string("The mean for the histogram ") + std::to_string(column) + " is less than 5. ");
+    }
+    ErrorHandle::getInstance().logStatus(std::to_string(configuredColumns.size()) + " Lut detectors in range, " +
+                                         std::to_string(processingPlan.size()) + " of them have data to process.");
+}
+
+uint64_t TaskHandler::computeFitSettingsHash() const
+{
+    // Everything that is the same for all detectors and changes their peaks or polynomials
+    uint64_t hash = RunManifest::hashBytes(energyArray, sizeof(double) * size);
+    hash = RunManifest::hashString(argumentsManager.getSourcesName(), hash);
+    hash = RunManifest::hashValue(argumentsManager.getNumberOfPeaks(), hash);
+    hash = RunManifest::hashValue(argumentsManager.getMaxAmplitude(), hash);
+    hash = RunManifest::hashValue(argumentsManager.getPolynomialFitThreshold(), hash);
+    const TAxis *channelAxis = inputTH2->GetYaxis();
+    hash = RunManifest::hashValue(channelAxis->GetNbins(), hash);
+    hash = RunManifest::hashValue(channelAxis->GetXmin(), hash);
+    return RunManifest::hashValue(channelAxis->GetXmax(), hash);
+}
+
+uint64_t TaskHandler::computeSettingsHash() const
+{
+    // The output files depend on the enabled outputs and the TH2 width as well
+    uint64_t hash = RunManifest::hashValue(fileManager.getEnabledOutputs(), fitSettingsHash);
+    return RunManifest::hashValue(inputTH2->GetNbinsX(), hash);
+}
+
+uint64_t TaskHandler::getCacheKey(int column) const
+{
+    uint64_t hash = RunManifest::hashValue(CalibrationCache::ALGORITHM_VERSION, fitSettingsHash);
+    return RunManifest::hashValue(columnHashes.at(column), hash);
+}
+
+void TaskHandler::hashPlannedColumns()
+{
+    fitSettingsHash = computeFitSettingsHash();
+    manifest.setSettingsHash(computeSettingsHash());
+    for (int column : processingPlan)
+    {
+        // Raw counts of the column (hashed by the preflight pass) and the LUT entry of its detector
+        int histIndex = argumentsManager.getNumberColumnSpecified(column);
+        uint64_t hash = columnStatistics[column].contentHash;
+        hash = RunManifest::hashValue(argumentsManager.getXminFile(histIndex), hash);
+        hash = RunManifest::hashValue(argumentsManager.getXmaxFile(histIndex), hash);
+        hash = RunManifest::hashValue(argumentsManager.getFWHMmaxFile(histIndex), hash);
+        hash = RunManifest::hashValue(argumentsManager.getMinAmplitudeFile(histIndex), hash);
+        hash = RunManifest::hashValue(argumentsManager.getDetTypeFile(histIndex), hash);
+        columnHashes[column] = RunManifest::hashString(argumentsManager.getSerialFile(histIndex), hash);
+    }
+}
+
+void TaskHandler::planIncrementalRun()
+{
+    RunManifest previousManifest;
+    if (!previousManifest.readFromFile(fileManager.getOutputFilePath("_manifest.json")) ||
+        previousManifest.getSettingsHash() != manifest.getSettingsHash())
+    {
+        ErrorHandle::getInstance().logStatus("Incremental: no compatible manifest of a previous run, all detectors are processed.");
         return;
     }
 
-    hist.findPeaks();
-    hist.calibratePeaks(energyArray, size);
-    hist.applyXCalibration();
-    hist.outputPeaksDataJson(fileManager.getJsonFile());
-    hist.printHistogramWithPeaksRoot(fileManager.getOutputFileHistograms());
-    hist.printCalibratedHistogramRoot(fileManager.getOutputFileCalibrated());
-    histograms.push_back(hist);
+    // Detectors with the same inputs keep their previous results, only the others are fitted again
+    std::vector<int> changedColumns;
+    for (int column : processingPlan)
+    {
+        const RunManifest::Entry *entry = previousManifest.findEntry(column);
+        if (entry && entry->hash == columnHashes[column])
+        {
+            reusedColumns.push_back(column);
+            manifest.setEntry(column, *entry);
+        }
+        else
+        {
+            changedColumns.push_back(column);
+        }
+    }
+    processingPlan.swap(changedColumns);
+    ErrorHandle::getInstance().logStatus("Incremental: " + std::to_string(processingPlan.size()) + " detectors changed, " +
+                                         std::to_string(reusedColumns.size()) + " reused from the previous run.");
+}
 
-    if (argumentsManager.isUserInterfaceEnabled())
+void TaskHandler::spliceReusedDetectors()
+{
+    std::set<int> reused(reusedColumns.begin(), reusedColumns.end());
+    for (int column : reusedColumns)
     {
-        ui.showCalibrationInfo(hist);
+        const std::vector<double> &coefficients = manifest.findEntry(column)->coefficients;
+        if (fileManager.isOutputEnabled(FileManager::CALIBRATION_TABLE))
+        {
+            calibrationTable.addDetector(column, coefficients);
+        }
+        if (fileManager.isOutputEnabled(FileManager::ROOT_GAMMA_GAMMA) && !coefficients.empty())
+        {
+            detectorCoefficients[column] = coefficients;
+        }
+    }
+    if (fileManager.isOutputEnabled(FileManager::JSON_PEAKS))
+    {
+        spliceJsonOutput(reused);
+    }
+    if (fileManager.isOutputEnabled(FileManager::ROOT_PEAKS))
+    {
+        copyPreviousHistograms("_peaks.root", fileManager.getOutputFileHistograms(), reused);
+    }
+    if (fileManager.isOutputEnabled(FileManager::ROOT_CALIBRATED))
+    {
+        copyPreviousHistograms("_calibrated_histograms.root", fileManager.getOutputFileCalibrated(), reused);
+    }
+    if (fileManager.isOutputEnabled(FileManager::ROOT_PEAK_TREE))
+    {
+        peakTree.copyRows(fileManager.getPreviousOutputFilePath("_peak_tree.root"), reused);
+    }
+    if (!calibratedColumnsDone.empty())
+    {
+        copyPreviousCalibratedColumns(reused);
     }
+}
 
-    delete hist1D;
+void TaskHandler::spliceJsonOutput(const std::set<int> &reused)
+{
+    // The new file only holds the changed detectors, the merged file keeps the domain order of a full run
+    std::string path = fileManager.getOutputFilePath("_peaks_data.json");
+    fileManager.finishJsonFile();
+    std::map<int, std::string> records = FileManager::readJsonRecords(path);
+    for (const auto &record : FileManager::readJsonRecords(fileManager.getPreviousOutputFilePath("_peaks_data.json")))
+    {
+        if (reused.count(record.first))
+        {
+            records.insert(record);
+        }
+    }
+    FileManager::writeJsonRecords(path, records);
 }
 
-void TaskHandler::combineHistogramsIntoTH2()
+void TaskHandler::copyPreviousHistograms(const std::string &suffix, TFile *outputFile, const std::set<int> &reused)
 {
-    fileManager.updateHistogramName(inputTH2);
-    fillTH2FromHistograms();
-    fileManager.saveTH2Histogram(inputTH2);
+    std::unique_ptr<TFile> previousFile(TFile::Open(fileManager.getPreviousOutputFilePath(suffix).c_str(), "READ"));
+    if (!previousFile || previousFile->IsZombie() || !outputFile)
+    {
+        ErrorHandle::getInstance().logStatus("Incremental: previous " + suffix + " not found, reused detectors are missing from it.");
+        return;
+    }
+
+    // Histograms are named after their column (hist1D_col<domain>), only the latest cycle is copied
+    std::set<std::string> copied;
+    TIter next(previousFile->GetListOfKeys());
+    while (TKey *key = static_cast<TKey *>(next()))
+    {
+        std::string name = key->GetName();
+        std::size_t pos = name.find_last_not_of("0123456789");
+        if (pos == std::string::npos || pos + 1 == name.size() || !reused.count(std::stoi(name.substr(pos + 1))) ||
+            !copied.insert(name).second)
+            continue;
+        std::unique_ptr<TObject> object(key->ReadObj());
+        outputFile->cd();
+        object->Write();
+    }
+}
+
+void TaskHandler::copyPreviousCalibratedColumns(const std::set<int> &reused)
+{
+    std::unique_ptr<TFile> previousFile(TFile::Open(fileManager.getPreviousOutputFilePath("_combinedHistogram.root").c_str(), "READ"));
+    std::unique_ptr<TH2F> previous;
+    if (previousFile && !previousFile->IsZombie())
+    {
+        TIter next(previousFile->GetListOfKeys());
+        while (TKey *key = static_cast<TKey *>(next()))
+        {
+            if (std::string(key->GetClassName()) == "TH2F")
+            {
+                previous.reset(static_cast<TH2F *>(key->ReadObj()));
+                break;
+            }
+        }
+    }
+    if (!previous || previous->GetNbinsX() != inputTH2->GetNbinsX() || previous->GetNbinsY() != inputTH2->GetNbinsY())
+    {
+        ErrorHandle::getInstance().logStatus("Incremental: previous combined histogram not usable, reused detectors are missing from it.");
+        return;
+    }
+
+    int cellsX = previous->GetNbinsX() + 2;
+    int cellsY = previous->GetNbinsY() + 2;
+    const float *cells = previous->GetArray();
+    std::vector<float> calibratedColumn(cellsY);
+    for (int column : reused)
+    {
+        for (int y = 0; y < cellsY; ++y)
+        {
+            calibratedColumn[y] = cells[column + static_cast<size_t>(cellsX) * y];
+        }
+        storeCalibratedColumn(column, calibratedColumn.data());
+    }
+}
+
+std::unique_ptr<Histogram> TaskHandler::prepareHistogram(std::unique_ptr<TH1D> hist1D, int column)
+{
+    int histIndex = argumentsManager.getNumberColumnSpecified(column);
+    if (!hist1D || histIndex == -1)
+    {
+        return nullptr;
+    }
+
+    ErrorHandle::getInstance().logStatus(std::string("Histogram: ") + std::to_string(column) + " start to be processed.");
+    ErrorHandle::getInstance().logStatus("start------------------------------------------------.");
+    std::unique_ptr<Histogram> hist(new Histogram(
+        argumentsManager.getXminFile(histIndex), argumentsManager.getXmaxFile(histIndex),
+        argumentsManager.getFWHMmaxFile(histIndex), argumentsManager.getMinAmplitudeFile(histIndex),
+        argumentsManager.getMaxAmplitude(), argumentsManager.getSerialFile(histIndex),
+        argumentsManager.getDetTypeFile(histIndex), argumentsManager.getPolynomialFitThreshold(),
+        argumentsManager.getNumberOfPeaks(), std::move(hist1D),
+        argumentsManager.getHistogramNameFile(histIndex), argumentsManager.getSourcesName()));
+    hist->setActiveRange(columnStatistics[column].firstBin, columnStatistics[column].lastBin);
+    return hist;
+}
+
+void TaskHandler::analyzeHistogram(Histogram &hist, int column)
+{
+    // Finished before a crash (-resume), or same column, LUT entry and fit settings as an earlier run:
+    // the fits are replaced by a lookup
+    CalibrationCache::Result cachedResult;
+    if (const CalibrationCache::Result *finishedResult = journal.find(column, columnHashes.at(column)))
+    {
+        hist.importResults(*finishedResult, "checkpoint journal");
+    }
+    else if (calibrationCache && calibrationCache->lookup(getCacheKey(column), cachedResult))
+    {
+        hist.importResults(cachedResult, "cache");
+    }
+    else
+    {
+        hist.findPeaks();
+        hist.calibratePeaks(energyArray, size);
+        if (calibrationCache)
+        {
+            calibrationCache->store(getCacheKey(column), hist.exportResults());
+        }
+    }
+
+    // Every column owns its slice of the buffer, so workers can fill it concurrently
+    if (!calibratedColumnsDone.empty())
+    {
+        std::vector<float> calibratedColumn(inputTH2->GetNbinsY() + 2, 0.0f);
+        hist.applyXCalibration(calibratedColumn.data());
+        storeCalibratedColumn(column, calibratedColumn.data());
+    }
 }
 
-void TaskHandler::fillTH2FromHistograms()
+void TaskHandler::outputHistogram(Histogram &hist, int column, const std::string *jsonRecord)
 {
-    if (!inputTH2)
+    // Calibrated spectra are only materialized for the outputs that consume them
+    if (fileManager.isOutputEnabled(FileManager::ROOT_CALIBRATED) || argumentsManager.isUserInterfaceEnabled())
+    {
+        hist.applyXCalibration();
+    }
+    manifest.setEntry(column, {columnHashes.at(column), hist.getCoefficients()});
+    journal.append(column, columnHashes.at(column), hist.exportResults());
+    if (fileManager.isOutputEnabled(FileManager::CALIBRATION_TABLE))
+    {
+        calibrationTable.addDetector(column, hist.getCoefficients());
+    }
+    if (fileManager.isOutputEnabled(FileManager::ROOT_GAMMA_GAMMA) && !hist.getCoefficients().empty())
+    {
+        detectorCoefficients[column] = hist.getCoefficients();
+    }
+    if (fileManager.isOutputEnabled(FileManager::JSON_PEAKS))
+    {
+        // Records formatted by the fit workers are only written here, in column order
+        if (jsonRecord)
+        {
+            fileManager.writeJsonRecord(*jsonRecord);
+        }
+        else
+        {
+            jsonWriter.clear();
+            hist.outputPeaksDataJson(jsonWriter);
+            fileManager.writeJsonRecord(jsonWriter.str());
+        }
+    }
+    if (fileManager.isOutputEnabled(FileManager::ROOT_PEAK_TREE))
+    {
+        peakTree.fill(hist, column);
+    }
+    if (fileManager.isOutputEnabled(FileManager::ROOT_PEAKS))
+    {
+        hist.printHistogramWithPeaksRoot(fileManager.getOutputFileHistograms());
+    }
+    if (fileManager.isOutputEnabled(FileManager::ROOT_CALIBRATED))
+    {
+        hist.printCalibratedHistogramRoot(fileManager.getOutputFileCalibrated());
+    }
+
+    if (argumentsManager.isUserInterfaceEnabled())
+    {
+        ui.showCalibrationInfo(hist);
+    }
+}
+
+void TaskHandler::processSingleHistogram(std::unique_ptr<TH1D> hist1D, int column)
+{
+    std::unique_ptr<Histogram> hist = prepareHistogram(std::move(hist1D), column);
+    if (!hist)
+    {
+        if (argumentsManager.isUserInterfaceEnabled())
+        {
+            histograms.emplace_back();
+        }
         return;
+    }
+
+    analyzeHistogram(*hist, column);
+    outputHistogram(*hist, column);
+    // Only the User Interface looks at the detectors again, otherwise they are released here
+    if (argumentsManager.isUserInterfaceEnabled())
+    {
+        histograms.push_back(std::move(*hist));
+    }
+}
+
+void TaskHandler::processColumnsInPipeline()
+{
+    // Extraction runs on its own thread, the columns of every extracted batch are added to one job stream
+    // of the worker pool and the batches are handed to the output writer of the FileManager in column
+    // order, each as soon as all its fits are done. There is no barrier between batches, the workers go
+    // on with the next batch while the last columns of the previous one are fitted. At most
+    // PIPELINE_BATCHES_IN_FLIGHT batches are held between extraction and output, which bounds the memory.
+    ColumnPipeline pipeline;
+    pipeline.batchSize = COLUMNS_PER_WORKER * workerPool->getNumberOfWorkers();
+    size_t numberOfBatches = (processingPlan.size() + pipeline.batchSize - 1) / pipeline.batchSize;
+    pipeline.batches.resize(numberOfBatches);
+    std::vector<double> columnCosts = estimateColumnCosts();
+    double extractionSeconds = 0;
+    auto pipelineStart = std::chrono::steady_clock::now();
+
+    workerPool->startStream([this, &pipeline](int, int job)
+                            { fitColumn(pipeline, job); });
+    std::thread extractor([&]
+                          { extractionSeconds = extractColumns(pipeline, columnCosts); });
+
+    for (size_t batchNumber = 0; batchNumber < numberOfBatches; ++batchNumber)
+    {
+        // std::function needs a copyable job, the batch itself only moves
+        std::shared_ptr<ColumnBatch> finishedBatch;
+        {
+            std::unique_lock<std::mutex> lock(pipeline.mutex);
+            pipeline.changed.wait(lock, [&]
+                                  { return pipeline.batches[batchNumber] && pipeline.batches[batchNumber]->remainingFits == 0; });
+            finishedBatch = std::move(pipeline.batches[batchNumber]);
+            --pipeline.batchesInFlight;
+        }
+        pipeline.changed.notify_all();
+        fileManager.submitOutput([this, finishedBatch]
+                                 { writeColumns(*finishedBatch); });
+    }
+    extractor.join();
+    workerPool->closeStream();
+    workerPool->wait();
 
-    inputTH2->Reset();
-    int numCols = inputTH2->GetNbinsX();
-    int numRows = inputTH2->GetNbinsY();
+    double pipelineSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - pipelineStart).count();
+    ErrorHandle::getInstance().logStatus("Pipeline: " + std::to_string(pipelineSeconds) + " s, extraction busy " +
+                                         std::to_string(extractionSeconds) + " s.");
+    logWorkerUtilization(workerPool->getStatistics(), pipelineSeconds);
+}
 
-    for (size_t i = 0; i < histograms.size(); ++i)
+double TaskHandler::extractColumns(ColumnPipeline &pipeline, const std::vector<double> &costs)
+{
+    bool formatJson = fileManager.isOutputEnabled(FileManager::JSON_PEAKS);
+    double busySeconds = 0;
+    for (size_t batchFirstJob = 0; batchFirstJob < processingPlan.size(); batchFirstJob += pipeline.batchSize)
     {
-        TH1D *hist1D = histograms[i].getCalibratedHist();
-        if (hist1D)
         {
-            for (int binY = 1; binY <= hist1D->GetNbinsX(); ++binY)
+            std::unique_lock<std::mutex> lock(pipeline.mutex);
+            pipeline.changed.wait(lock, [&]
+                                  { return pipeline.batchesInFlight < PIPELINE_BATCHES_IN_FLIGHT; });
+            ++pipeline.batchesInFlight;
+        }
+        auto batchStart = std::chrono::steady_clock::now();
+        std::shared_ptr<ColumnBatch> batch = std::make_shared<ColumnBatch>();
+        batch->firstJob = batchFirstJob;
+        size_t batchEndJob = std::min(batchFirstJob + pipeline.batchSize, processingPlan.size());
+        bool loaded = true;
+        try
+        {
+            // Only the columns of this batch are copied out of the TH2
+            loadColumnMatrix(batchFirstJob, batchEndJob);
+        }
+        catch (const std::exception &exception)
+        {
+            ErrorHandle::getInstance().logStatus("Columns " + std::to_string(processingPlan[batchFirstJob]) + " to " +
+                                                 std::to_string(processingPlan[batchEndJob - 1]) + " could not be loaded: " + exception.what());
+            loaded = false;
+        }
+        for (size_t job = batchFirstJob; job < batchEndJob; ++job)
+        {
+            // A column that can not be extracted is skipped like one without data, the thread goes on
+            int column = processingPlan[job];
+            std::unique_ptr<Histogram> hist;
+            try
             {
-                double content = hist1D->GetBinContent(binY);
-                if (i + 1 <= numCols && binY <= numRows)
+                if (loaded)
                 {
-                    inputTH2->SetBinContent(i + 1, binY, content);
+                    hist = prepareHistogram(columnMatrix.createHistogram(column, Form("hist1D_col%d", column)), column);
                 }
             }
+            catch (const std::exception &exception)
+            {
+                ErrorHandle::getInstance().logStatus(std::string("Histogram: ") + std::to_string(column) + " extraction failed: " + exception.what());
+                hist.reset();
+            }
+            batch->histograms.push_back(std::move(hist));
+        }
+        if (formatJson)
+        {
+            batch->jsonRecords.assign(batch->histograms.size(), std::string());
+        }
+
+        std::vector<int> jobs;
+        std::vector<double> jobCosts;
+        for (size_t job = batchFirstJob; job < batchEndJob; ++job)
+        {
+            if (batch->histograms[job - batchFirstJob])
+            {
+                jobs.push_back(job);
+                jobCosts.push_back(costs[job]);
+            }
+        }
+        batch->remainingFits = jobs.size();
+        busySeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - batchStart).count();
+        {
+            std::lock_guard<std::mutex> lock(pipeline.mutex);
+            pipeline.batches[batchFirstJob / pipeline.batchSize] = batch;
+        }
+        pipeline.changed.notify_all();
+        workerPool->addJobs(jobs, jobCosts);
+    }
+    return busySeconds;
+}
+
+void TaskHandler::loadColumnMatrix(size_t firstJob, size_t endJob)
+{
+    // A float32 raw spectra file or list-mode spectra are not copied, the matrix points into them
+    std::vector<int> columns(processingPlan.begin() + firstJob, processingPlan.begin() + endJob);
+    if (const RawSpectraFile *spectra = fileManager.getRawSpectra())
+    {
+        columnMatrix.load(*spectra, columns);
+    }
+    else if (const ListModeSpectra *spectra = fileManager.getListModeSpectra())
+    {
+        columnMatrix.load(*spectra, columns);
+    }
+    else
+    {
+        columnMatrix.load(*inputTH2, columns);
+    }
+}
+
+void TaskHandler::fitColumn(ColumnPipeline &pipeline, int job)
+{
+    // The batch was published before its jobs were added, the pool's queue lock orders the two
+    ColumnBatch *batch;
+    {
+        std::lock_guard<std::mutex> lock(pipeline.mutex);
+        batch = pipeline.batches[job / pipeline.batchSize].get();
+    }
+    size_t position = job - batch->firstJob;
+    int column = processingPlan[job];
+    std::unique_ptr<Histogram> &hist = batch->histograms[position];
+    try
+    {
+        analyzeHistogram(*hist, column);
+        if (!batch->jsonRecords.empty())
+        {
+            // Every worker reuses its own buffer, the writer thread only copies the finished record
+            static thread_local JsonWriter workerJsonWriter("\t", 1);
+            workerJsonWriter.clear();
+            hist->outputPeaksDataJson(workerJsonWriter);
+            batch->jsonRecords[position] = workerJsonWriter.str();
+        }
+    }
+    catch (const std::exception &exception)
+    {
+        ErrorHandle::getInstance().logStatus(std::string("Histogram: ") + std::to_string(column) + " failed: " + exception.what());
+        hist.reset();
+    }
+
+    bool batchDone;
+    {
+        std::lock_guard<std::mutex> lock(pipeline.mutex);
+        batchDone = --batch->remainingFits == 0;
+    }
+    if (batchDone)
+    {
+        pipeline.changed.notify_all();
+    }
+}
+
+void TaskHandler::writeColumns(ColumnBatch &batch)
+{
+    // Batches are submitted in column order, so the outputs keep the order of a serial run. Only this
+    // thread touches the output files; the other stages create their ROOT objects unregistered
+    // (see configureParallelProcessing), so nothing is locked and extraction never waits on a write.
+    // printHistogramWithPeaksRoot() fits here while the workers run Minuit2: this relies on
+    // ROOT::EnableThreadSafety() having been called in configureParallelProcessing(), before the
+    // writer is started, which is the case whenever the pipeline runs.
+    for (size_t job = 0; job < batch.histograms.size(); ++job)
+    {
+        int column = processingPlan[batch.firstJob + job];
+        std::unique_ptr<Histogram> hist = std::move(batch.histograms[job]);
+        try
+        {
+            // The pipeline runs without the User Interface, the detector is released after its output
+            if (hist)
+            {
+                outputHistogram(*hist, column, batch.jsonRecords.empty() ? nullptr : &batch.jsonRecords[job]);
+            }
+        }
+        catch (const std::exception &exception)
+        {
+            ErrorHandle::getInstance().logStatus(std::string("Histogram: ") + std::to_string(column) + " output failed: " + exception.what());
+        }
+        hist.reset();
+    }
+}
+
+std::vector<double> TaskHandler::estimateColumnCosts() const
+{
+    // Peak search and calibration scan the active channel range once per requested peak,
+    // on top of the fits, which take more minimizer iterations (and find more candidate
+    // peaks) the more counts the spectrum has, roughly with the order of magnitude
+    const double fitCost = 1000;        // one fit, in units of scanned channels
+    const double countsFitWeight = 0.25; // extra fit cost per decade of counts
+    int numberOfPeaks = argumentsManager.getNumberOfPeaks();
+    std::vector<double> costs;
+    costs.reserve(processingPlan.size());
+    for (int column : processingPlan)
+    {
+        const ColumnStatistics &statistics = columnStatistics[column];
+        int span = statistics.lastBin - statistics.firstBin + 1;
+        double fit = fitCost * (1 + countsFitWeight * std::log10(1 + std::max(statistics.integral, 0.0)));
+        costs.push_back(fit + numberOfPeaks * (span + fit));
+    }
+    return costs;
+}
+
+void TaskHandler::logWorkerUtilization(const std::vector<WorkerPool::WorkerStatistics> &statistics, double batchSeconds) const
+{
+    for (size_t worker = 0; worker < statistics.size(); ++worker)
+    {
+        double utilization = batchSeconds > 0 ? 100 * statistics[worker].busySeconds / batchSeconds : 0;
+        ErrorHandle::getInstance().logStatus("Worker " + std::to_string(worker) + ": " +
+                                             std::to_string(statistics[worker].jobs) + " columns (" +
+                                             std::to_string(statistics[worker].stolenJobs) + " stolen), busy " +
+                                             std::to_string(statistics[worker].busySeconds) + " s of " +
+                                             std::to_string(batchSeconds) + " s (" + std::to_string(utilization) + "%).");
+    }
+}
+
+void TaskHandler::configureParallelProcessing()
+{
+    // The User Interface shows every detector while it is processed and -w 1 fits like a plain serial
+    // run (same minimizer, no background threads), both keep the serial loop
+    int numberOfWorkers = argumentsManager.getNumberOfWorkers();
+    if (numberOfWorkers <= 1 || argumentsManager.isUserInterfaceEnabled())
+    {
+        return;
+    }
+
+    // Projections, fit functions and outputs are created on different threads, none of them is registered globally
+    ROOT::EnableThreadSafety();
+    TH1::AddDirectory(false);
+    TF1::DefaultAddToGlobalList(false);
+    ROOT::Math::MinimizerOptions::SetDefaultMinimizer("Minuit2");
+    workerPool.reset(new WorkerPool(numberOfWorkers));
+    ErrorHandle::getInstance().logStatus("Pipelined processing with " + std::to_string(numberOfWorkers) + " fit workers.");
+}
+
+void TaskHandler::combineHistogramsIntoTH2()
+{
+    fileManager.updateHistogramName(inputTH2);
+    clearUncalibratedColumns();
+    // The GammaGamma matrices are calibrated while the writer compresses the combined TH2
+    fileManager.submitOutput([this]
+                             { fileManager.saveTH2Histogram(inputTH2); });
+}
+
+void TaskHandler::storeCalibratedColumn(int column, const float *calibratedColumn)
+{
+    // Only this column is written, the raw columns still to be read are left alone
+    int cellsX = inputTH2->GetNbinsX() + 2;
+    int cellsY = inputTH2->GetNbinsY() + 2;
+    float *cells = inputTH2->GetArray();
+    for (int y = 0; y < cellsY; ++y)
+    {
+        cells[column + static_cast<size_t>(cellsX) * y] = calibratedColumn[y];
+    }
+    calibratedColumnsDone[column] = 1;
+}
+
+void TaskHandler::clearUncalibratedColumns()
+{
+    if (!inputTH2 || calibratedColumnsDone.empty())
+        return;
+
+    // Columns that were not calibrated (not in the LUT, no data, failed) still hold raw counts
+    int cellsX = inputTH2->GetNbinsX() + 2;
+    int cellsY = inputTH2->GetNbinsY() + 2;
+    float *cells = inputTH2->GetArray();
+    for (int y = 0; y < cellsY; ++y)
+    {
+        float *row = cells + static_cast<size_t>(cellsX) * y;
+        for (int x = 0; x < cellsX; ++x)
+        {
+            if (!calibratedColumnsDone[x])
+                row[x] = 0;
         }
     }
+    inputTH2->ResetStats();
+    std::vector<char>().swap(calibratedColumnsDone);
+}
+
+void TaskHandler::saveCalibrationTable()
+{
+    std::string path = fileManager.getOutputFilePath("_calibration_table.bin");
+    if (calibrationTable.writeToFile(path))
+    {
+        ErrorHandle::getInstance().logStatus("Calibration table with " + std::to_string(calibrationTable.getNumberOfDetectors()) + " detectors saved in: " + path);
+    }
+    else
+    {
+        ErrorHandle::getInstance().logStatus("Error: Could not write calibration table: " + path);
+    }
+}
+
+const std::vector<double> *TaskHandler::findMatrixCoefficients(const std::string &matrixName) const
+{
+    // Per-detector matrices end with their domain number, summed ones use the reference detector
+    std::size_t pos = matrixName.find_last_not_of("0123456789");
+    int domain = argumentsManager.getGammaGammaReferenceDomain();
+    int suffix = 0;
+    const char *suffixEnd = matrixName.data() + matrixName.size();
+    if (pos != std::string::npos && pos + 1 < matrixName.size() &&
+        std::from_chars(matrixName.data() + pos + 1, suffixEnd, suffix).ec == std::errc() &&
+        detectorCoefficients.count(suffix))
+    {
+        domain = suffix;
+    }
+    auto it = detectorCoefficients.find(domain);
+    return it != detectorCoefficients.end() ? &it->second : nullptr;
+}
+
+void TaskHandler::calibrateGammaGammaMatrices()
+{
+    TDirectory *directory = fileManager.getInputDirectory("GammaGamma");
+    TFile *outputFile = fileManager.getOutputFileGammaGamma();
+    if (!directory || !outputFile || !inputTH2)
+    {
+        return;
+    }
+
+    // Only matrices with the raw channel binning on both axes are energy-energy matrices
+    const TAxis *channelAxis = inputTH2->GetYaxis();
+    auto isChannelAxis = [channelAxis](const TAxis *axis)
+    {
+        return axis->GetNbins() == channelAxis->GetNbins() && axis->GetXmin() == channelAxis->GetXmin() &&
+               axis->GetXmax() == channelAxis->GetXmax();
+    };
+
+    TIter next(directory->GetListOfKeys());
+    while (TKey *key = static_cast<TKey *>(next()))
+    {
+        if (std::string(key->GetClassName()) != "TH2F")
+            continue;
+
+        std::unique_ptr<TH2F> matrix(static_cast<TH2F *>(key->ReadObj()));
+        matrix->SetDirectory(nullptr);
+        std::string name = matrix->GetName();
+        if (!isChannelAxis(matrix->GetXaxis()) || !isChannelAxis(matrix->GetYaxis()))
+        {
+            ErrorHandle::getInstance().logStatus("GammaGamma matrix " + name + " is not a channel-channel matrix, skipped.");
+            continue;
+        }
+        const std::vector<double> *coefficients = findMatrixCoefficients(name);
+        if (!coefficients)
+        {
+            ErrorHandle::getInstance().logStatus("No calibration for GammaGamma matrix " + name + ", use -gg <domain> to choose one.");
+            continue;
+        }
+
+        const TAxis *xAxis = matrix->GetXaxis();
+        const TAxis *yAxis = matrix->GetYaxis();
+        CalibrationRebinner xRebinner(*coefficients, xAxis->GetNbins(), xAxis->GetXmin(), xAxis->GetXmax(),
+                                      xAxis->GetNbins(), xAxis->GetXmin(), xAxis->GetXmax());
+        CalibrationRebinner yRebinner(*coefficients, yAxis->GetNbins(), yAxis->GetXmin(), yAxis->GetXmax(),
+                                      yAxis->GetNbins(), yAxis->GetXmin(), yAxis->GetXmax());
+        if (!xRebinner.isValid() || !yRebinner.isValid())
+        {
+            ErrorHandle::getInstance().logStatus("Calibration of GammaGamma matrix " + name + " gives non-finite energies, skipped.");
+            continue;
+        }
+
+        std::shared_ptr<TH2F> calibrated(static_cast<TH2F *>(matrix->Clone((name + "_calib").c_str())));
+        calibrated->SetDirectory(nullptr);
+        calibrated->Reset();
+        yRebinner.rebin2D(xRebinner, matrix->GetArray(), calibrated->GetArray());
+        calibrated->ResetStats();
+
+        fileManager.submitOutput([outputFile, calibrated]
+                                 {
+            outputFile->cd();
+            calibrated->Write(); });
+        ErrorHandle::getInstance().logStatus("GammaGamma matrix " + name + " calibrated.");
+    }
 }
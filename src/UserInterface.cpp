@@ -76,7 +76,7 @@ double *UserInterface::askAboutSource(CalibrationDataProvider &energys, int &siz
     return combinedEnergyArray;
 }
 
-void UserInterface::askAboutPeaks(std::vector<Histogram> &histograms, std::ofstream &jsonFile, TFile *outputFileHistograms, TFile *outputFileCalibrated)
+void UserInterface::askAboutPeaks(std::vector<Histogram> &histograms, FileManager &fileManager)
 {
     std::cout << "Do you want to change a peak? (Y/N)" << std::endl;
     char answer;
@@ -117,8 +117,10 @@ void UserInterface::askAboutPeaks(std::vector<Histogram> &histograms, std::ofstr
         std::cin >> newPosition;
 
         histograms[histogramNumber].changePeak(peakNumber, newPosition);
-        histograms[histogramNumber].outputPeaksDataJson(jsonFile);
-        histograms[histogramNumber].printHistogramWithPeaksRoot(outputFileHistograms);
+        JsonWriter writer("\t", 1);
+        histograms[histogramNumber].outputPeaksDataJson(writer);
+        fileManager.writeJsonRecord(writer.str());
+        histograms[histogramNumber].printHistogramWithPeaksRoot(fileManager.getOutputFileHistograms());
 
         std::cout << "Do you want to change another peak? (Y/N)" << std::endl;
         std::cin >> answer;
@@ -0,0 +1,208 @@
+#include "../include/WorkerPool.h"
+#include <algorithm>
+#include <numeric>
+
+WorkerPool::WorkerPool(int numberOfWorkers)
+    : numberOfWorkers(std::max(numberOfWorkers, 1)), batchNumber(0), activeWorkers(0), stopping(false),
+      streaming(false), streamClosed(false), jobsVersion(0), nextQueue(0), batchSeconds(0)
+{
+    statistics.resize(this->numberOfWorkers);
+    for (int worker = 0; worker < this->numberOfWorkers; ++worker)
+    {
+        queues.emplace_back(new WorkerQueue());
+    }
+    for (int worker = 0; worker < this->numberOfWorkers; ++worker)
+    {
+        workers.emplace_back(&WorkerPool::workerLoop, this, worker);
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    batchAvailable.notify_all();
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+}
+
+void WorkerPool::dealJobs(std::vector<int> jobs, const std::vector<double> &costs)
+{
+    // Heaviest-first, dealt round-robin so every queue gets a heavy job; costs[i] belongs to jobs[i]
+    std::vector<int> order(jobs.size());
+    std::iota(order.begin(), order.end(), 0);
+    if (costs.size() == jobs.size())
+    {
+        std::stable_sort(order.begin(), order.end(), [&costs](int a, int b)
+                         { return costs[a] > costs[b]; });
+    }
+    for (int position : order)
+    {
+        WorkerQueue &queue = *queues[nextQueue];
+        nextQueue = (nextQueue + 1) % numberOfWorkers;
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.jobs.push_back(jobs[position]);
+    }
+}
+
+void WorkerPool::beginBatch(std::function<void(int, int)> task, bool stream)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->task = std::move(task);
+        std::fill(statistics.begin(), statistics.end(), WorkerStatistics());
+        streaming = stream;
+        streamClosed = false;
+        activeWorkers = numberOfWorkers;
+        batchStart = std::chrono::steady_clock::now();
+        ++batchNumber;
+    }
+    batchAvailable.notify_all();
+}
+
+void WorkerPool::start(int numberOfJobs, std::function<void(int worker, int job)> task, const std::vector<double> &costs)
+{
+    wait();
+    for (auto &queue : queues)
+    {
+        queue->jobs.clear();
+    }
+    nextQueue = 0;
+    std::vector<int> jobs(numberOfJobs);
+    std::iota(jobs.begin(), jobs.end(), 0);
+    dealJobs(jobs, costs);
+    beginBatch(std::move(task), false);
+}
+
+void WorkerPool::startStream(std::function<void(int worker, int job)> task)
+{
+    wait();
+    for (auto &queue : queues)
+    {
+        queue->jobs.clear();
+    }
+    nextQueue = 0;
+    beginBatch(std::move(task), true);
+}
+
+void WorkerPool::addJobs(const std::vector<int> &jobs, const std::vector<double> &costs)
+{
+    // Appended behind the pending jobs, the earlier additions are still taken first
+    dealJobs(jobs, costs);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++jobsVersion;
+    }
+    jobsAdded.notify_all();
+}
+
+void WorkerPool::closeStream()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        streamClosed = true;
+    }
+    jobsAdded.notify_all();
+}
+
+void WorkerPool::wait()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    batchFinished.wait(lock, [this]
+                       { return activeWorkers == 0; });
+}
+
+bool WorkerPool::takeJob(int worker, int &job, bool &stolen)
+{
+    stolen = false;
+    {
+        WorkerQueue &own = *queues[worker];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.jobs.empty())
+        {
+            job = own.jobs.front();
+            own.jobs.pop_front();
+            return true;
+        }
+    }
+
+    // Own queue is empty: steal the heaviest pending job of another worker
+    for (int offset = 1; offset < numberOfWorkers; ++offset)
+    {
+        WorkerQueue &victim = *queues[(worker + offset) % numberOfWorkers];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.jobs.empty())
+        {
+            job = victim.jobs.front();
+            victim.jobs.pop_front();
+            stolen = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkerPool::workerLoop(int worker)
+{
+    unsigned int lastBatch = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            batchAvailable.wait(lock, [&]
+                                { return stopping || batchNumber != lastBatch; });
+            if (stopping)
+            {
+                return;
+            }
+            lastBatch = batchNumber;
+        }
+
+        WorkerStatistics &workerStatistics = statistics[worker];
+        int job = 0;
+        bool stolen = false;
+        while (true)
+        {
+            // Jobs added before this version are in the queues once it is read
+            unsigned int seenVersion;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                seenVersion = jobsVersion;
+            }
+            while (takeJob(worker, job, stolen))
+            {
+                auto jobStart = std::chrono::steady_clock::now();
+                task(worker, job);
+                workerStatistics.busySeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - jobStart).count();
+                workerStatistics.jobs++;
+                workerStatistics.stolenJobs += stolen ? 1 : 0;
+            }
+
+            // A stream only ends once it is closed and nothing was added since the queues were found empty
+            std::unique_lock<std::mutex> lock(mutex);
+            if (!streaming)
+            {
+                break;
+            }
+            jobsAdded.wait(lock, [&]
+                           { return streamClosed || jobsVersion != seenVersion; });
+            if (jobsVersion == seenVersion)
+            {
+                break;
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--activeWorkers == 0)
+            {
+                batchSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - batchStart).count();
+            }
+        }
+        batchFinished.notify_all();
+    }
+}
@@ -0,0 +1,60 @@
+// Checks of the JsonWriter number formatting, no ROOT needed:
+//     g++ -std=c++17 tests/JsonWriterTest.cpp src/JsonWriter.cpp -Iinclude -o json_writer_test && ./json_writer_test
+#include "../include/JsonWriter.h"
+#include <cmath>
+#include <iostream>
+#include <string>
+
+namespace
+{
+    int failures = 0;
+
+    void expect(const std::string &name, const std::string &actual, const std::string &expected)
+    {
+        if (actual != expected)
+        {
+            std::cerr << name << ": expected " << expected << ", got " << actual << std::endl;
+            ++failures;
+        }
+    }
+
+    std::string format(float number)
+    {
+        JsonWriter writer;
+        writer.value(number);
+        return writer.str();
+    }
+
+    std::string format(double number)
+    {
+        JsonWriter writer;
+        writer.value(number);
+        return writer.str();
+    }
+}
+
+int main()
+{
+    // A float field (e.g. the PT of a detector) keeps the shortest digits of the float
+    expect("float", format(0.183011f), "0.183011");
+    expect("float integer", format(2.0f), "2");
+    expect("float NaN", format(std::nanf("")), "null");
+    expect("double", format(0.183011), "0.183011");
+    expect("double infinity", format(HUGE_VAL), "null");
+
+    JsonWriter writer("\t", 1);
+    writer.beginObject();
+    writer.key("PT");
+    writer.beginArray(true);
+    writer.value(0.183011f);
+    writer.value(0.0042f);
+    writer.endArray();
+    writer.endObject();
+    expect("record", writer.str(), "\t{\n\t\t\"PT\": [0.183011, 0.0042]\n\t}");
+
+    if (failures == 0)
+    {
+        std::cout << "JsonWriter: all checks passed." << std::endl;
+    }
+    return failures == 0 ? 0 : 1;
+}